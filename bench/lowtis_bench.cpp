@@ -0,0 +1,258 @@
+/*!
+ * Microbenchmarks for the lowtis hot paths.  All data comes from
+ * synthetic blocks so results do not depend on a server.  Each
+ * benchmark prints one JSON object per line, for example:
+ *
+ *   {"name": "composite_ortho", "bytedepth": 1, "iterations": 120,
+ *    "mean_us": 812.4, "median_us": 801.0, "min_us": 790.2}
+ *
+ * Usage: lowtis_bench [name filter] [min seconds per benchmark]
+*/
+
+#include <lowtis/lowtis.h>
+#include <lowtis/LowtisConfig.h>
+#include "src/BlockFetch.h"
+#include "src/BlockFetchFactory.h"
+#include "src/BlockCache.h"
+#include <libdvid/BinaryData.h>
+#include <libdvid/DVIDBlocks.h>
+#include <boost/thread/thread.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+
+using namespace lowtis;
+using namespace libdvid;
+using std::vector;
+using std::string;
+
+namespace {
+
+// substring that benchmark names must contain (empty = all)
+string name_filter;
+
+// minimum time spent on each benchmark (in seconds)
+double min_seconds = 0.5;
+
+/*!
+ * Times a function until min_seconds have passed (at least 3 runs)
+ * and prints the statistics as a JSON object.
+ * \param name benchmark name
+ * \param params extra JSON fields (e.g., "\"bytedepth\": 8")
+ * \param func code to time
+*/
+void run_bench(string name, string params, std::function<void()> func)
+{
+    if (name.find(name_filter) == string::npos) {
+        return;
+    }
+
+    // warm caches and lazy initialization
+    func();
+
+    vector<double> times;
+    double total = 0;
+    while ((times.size() < 3) || (total < min_seconds*1e6)) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        double elapsed = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count();
+        times.push_back(elapsed);
+        total += elapsed;
+    }
+    std::sort(times.begin(), times.end());
+
+    std::cout << "{\"name\": \"" << name << "\"";
+    if (!params.empty()) {
+        std::cout << ", " << params;
+    }
+    std::cout << ", \"iterations\": " << times.size()
+        << ", \"mean_us\": " << total / times.size()
+        << ", \"median_us\": " << times[times.size()/2]
+        << ", \"min_us\": " << times[0] << "}" << std::endl;
+}
+
+string bytedepth_param(size_t bytedepth)
+{
+    std::stringstream param;
+    param << "\"bytedepth\": " << bytedepth;
+    return param.str();
+}
+
+void bench_intersecting_blocks()
+{
+    SyntheticConfig config(1);
+    BlockFetchPtr fetcher = create_blockfetcher(&config);
+
+    vector<unsigned int> dims;
+    dims.push_back(1024);
+    dims.push_back(1024);
+    dims.push_back(1);
+    vector<int> offset(3, 1000);
+    vector<double> dim3step(3, 0);
+
+    vector<double> xstep(3, 0), ystep(3, 0);
+    xstep[0] = 1;
+    ystep[1] = 1;
+    run_bench("intersecting_blocks", "\"plane\": \"orthogonal\"", [&]() {
+        fetcher->intersecting_blocks(dims, offset, xstep, ystep, dim3step, 0);
+    });
+
+    // plane tilted about two axes
+    vector<double> ostep1(3, 0), ostep2(3, 0);
+    ostep1[0] = 0.8; ostep1[1] = 0.6;
+    ostep2[0] = -0.36; ostep2[1] = 0.48; ostep2[2] = 0.8;
+    run_bench("intersecting_blocks", "\"plane\": \"oblique\"", [&]() {
+        fetcher->intersecting_blocks(dims, offset, ostep1, ostep2, dim3step, 0);
+    });
+}
+
+void bench_compositing()
+{
+    const unsigned int width = 1024, height = 1024;
+    size_t bytedepths[] = {1, 2, 4, 8};
+
+    for (size_t bytedepth : bytedepths) {
+        // blocks are cached after the first (warm-up) call
+        SyntheticConfig config(bytedepth);
+        config.label_size = 40;
+        config.uncompressed_cache_size = 1000;
+        ImageService service(config);
+        vector<char> buffer(width*height*bytedepth);
+
+        vector<int> offset(3, 1000);
+        run_bench("composite_ortho", bytedepth_param(bytedepth), [&]() {
+            service.retrieve_image(width, height, offset, &buffer[0]);
+        });
+
+        vector<double> dim1(3, 0), dim2(3, 0);
+        dim1[0] = 0.8; dim1[1] = 0.6;
+        dim2[0] = -0.36; dim2[1] = 0.48; dim2[2] = 0.8;
+        vector<int> center(3, 1500);
+        run_bench("composite_arbitrary", bytedepth_param(bytedepth), [&]() {
+            service.retrieve_arbimage(width, height, center, dim1, dim2, &buffer[0]);
+        });
+    }
+}
+
+void bench_fovea()
+{
+    const unsigned int width = 1024, height = 1024;
+
+    SyntheticConfig config(1);
+    config.uncompressed_cache_size = 1000;
+    config.centercut = std::make_tuple(256, 256);
+    ImageService service(config);
+    vector<char> buffer(width*height);
+    vector<int> offset(3, 1000);
+
+    run_bench("fovea", "", [&]() {
+        service.retrieve_image(width, height, offset, &buffer[0], 0, true);
+    });
+}
+
+void bench_block_cache()
+{
+    const size_t blocksize = 64;
+    const int num_blocks = 4096;
+    const int num_threads = 8;
+
+    // ~1 MB of data per 4 blocks so eviction runs
+    BinaryDataPtr data = BinaryData::create_binary_data();
+    data->get_data().assign(blocksize*blocksize*blocksize, 'a');
+
+    BlockCache cache;
+    cache.set_max_size(200);
+
+    auto worker = [&](int id) {
+        Block block;
+        for (int i = 0; i < num_blocks; ++i) {
+            int pos = (i * num_threads + id) % num_blocks;
+            BlockCoords coords;
+            coords.x = pos * blocksize;
+            if (!cache.retrieve_block(coords, block)) {
+                cache.set_block(Block(coords, blocksize, 1,
+                            DVIDCompressedBlock::uncompressed, data));
+            }
+        }
+    };
+
+    std::stringstream param;
+    param << "\"threads\": " << num_threads << ", \"operations\": " << num_blocks*num_threads;
+    run_bench("block_cache", param.str(), [&]() {
+        boost::thread_group threads;
+        for (int id = 0; id < num_threads; ++id) {
+            threads.create_thread(std::bind(worker, id));
+        }
+        threads.join_all();
+    });
+}
+
+void bench_decompression()
+{
+    const size_t blocksize = 64;
+    vector<int> offset(3, 0);
+
+    // grayscale-like pattern that compresses moderately
+    BinaryDataPtr raw = BinaryData::create_binary_data();
+    string& rawdata = raw->get_data();
+    rawdata.resize(blocksize*blocksize*blocksize);
+    for (size_t i = 0; i < rawdata.size(); ++i) {
+        rawdata[i] = char((i % blocksize) + ((i / (blocksize*blocksize)) % 7) * 16);
+    }
+
+    DVIDCompressedBlock uncompressed(raw, offset, blocksize, 1,
+            DVIDCompressedBlock::uncompressed);
+    run_bench("decompress", "\"compression\": \"uncompressed\"", [&]() {
+        uncompressed.get_uncompressed_data();
+    });
+
+    DVIDCompressedBlock lz4block(BinaryData::compress_lz4(raw), offset, blocksize, 1,
+            DVIDCompressedBlock::lz4);
+    run_bench("decompress", "\"compression\": \"lz4\"", [&]() {
+        lz4block.get_uncompressed_data();
+    });
+
+    // jpeg blocks are stored as a blocksize x blocksize^2 image
+    DVIDCompressedBlock jpegblock(BinaryData::compress_jpeg(raw, blocksize,
+                blocksize*blocksize), offset, blocksize, 1, DVIDCompressedBlock::jpeg);
+    run_bench("decompress", "\"compression\": \"jpeg\"", [&]() {
+        jpegblock.get_uncompressed_data();
+    });
+
+    // libdvid has no gzip_labelarray encoder to make synthetic blocks
+    if (string("decompress").find(name_filter) != string::npos) {
+        std::cout << "{\"name\": \"decompress\", \"compression\": \"gzip_labelarray\", "
+            << "\"skipped\": true}" << std::endl;
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        name_filter = argv[1];
+    }
+    if (argc > 2) {
+        min_seconds = atof(argv[2]);
+    }
+
+    try {
+        bench_intersecting_blocks();
+        bench_compositing();
+        bench_fovea();
+        bench_block_cache();
+        bench_decompression();
+    } catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
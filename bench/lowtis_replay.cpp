@@ -0,0 +1,169 @@
+/*!
+ * Replays a trace recorded with ImageService::start_recording against
+ * a fresh ImageService and prints a JSON summary of the request
+ * latencies, cache hit rate and data fetched.
+ *
+ * Usage: lowtis_replay trace [key=value ...]
+ *
+ * Keys:
+ *   backend     synthetic (default), dvid or local
+ *   server, uuid, instance   DVID location (backend=dvid)
+ *   path        dataset path (backend=local)
+ *   latency, jitter, bandwidth   simulated server (backend=synthetic)
+ *   mutation    milliseconds between simulated label edits (backend=synthetic)
+ *   cache_size, uncompressed_cache_size   cache limits in MB
+ *   prefetch    1 to enable prefetch
+ *   realtime    1 to keep the recorded time between calls
+*/
+
+#include <lowtis/lowtis.h>
+#include <lowtis/LowtisConfig.h>
+#include "src/Trace.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace lowtis;
+using std::vector;
+using std::string;
+using std::map;
+
+namespace {
+
+string option(const map<string, string>& options, string key, string defval)
+{
+    auto iter = options.find(key);
+    return (iter == options.end()) ? defval : iter->second;
+}
+
+double percentile(vector<double> values, double fraction)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    size_t pos = std::min(values.size()-1, size_t(fraction*values.size()));
+    std::nth_element(values.begin(), values.begin()+pos, values.end());
+    return values[pos];
+}
+
+// creates the configuration for the selected back-end
+std::unique_ptr<LowtisConfig> create_config(const map<string, string>& options, size_t bytedepth)
+{
+    string backend = option(options, "backend", "synthetic");
+    std::unique_ptr<LowtisConfig> config;
+    if (backend == "dvid") {
+        DVIDConfig* dvidconfig;
+        if (bytedepth == 1) {
+            dvidconfig = new DVIDGrayblkConfig;
+        } else {
+            dvidconfig = new DVIDLabelblkConfig;
+        }
+        dvidconfig->dvid_server = option(options, "server", "127.0.0.1:8000");
+        dvidconfig->dvid_uuid = option(options, "uuid", "");
+        dvidconfig->datatypename = option(options, "instance", "");
+        config.reset(dvidconfig);
+    } else if (backend == "local") {
+        LocalVolumeConfig* localconfig = new LocalVolumeConfig(bytedepth);
+        localconfig->path = option(options, "path", "");
+        config.reset(localconfig);
+    } else if (backend == "synthetic") {
+        SyntheticConfig* syntheticconfig = new SyntheticConfig(bytedepth);
+        syntheticconfig->latency = atof(option(options, "latency", "0").c_str());
+        syntheticconfig->jitter = atof(option(options, "jitter", "0").c_str());
+        syntheticconfig->bandwidth = atof(option(options, "bandwidth", "0").c_str());
+        syntheticconfig->mutation_interval = atof(option(options, "mutation", "0").c_str());
+        config.reset(syntheticconfig);
+    } else {
+        throw LowtisErr("Unknown backend " + backend);
+    }
+
+    if (options.count("cache_size")) {
+        config->cache_size = atoi(options.at("cache_size").c_str());
+    }
+    if (options.count("uncompressed_cache_size")) {
+        config->uncompressed_cache_size = atoi(options.at("uncompressed_cache_size").c_str());
+    }
+    config->enableprefetch = (option(options, "prefetch", "0") == "1");
+    return config;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: lowtis_replay trace [key=value ...]" << std::endl;
+        return 1;
+    }
+
+    map<string, string> options;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        size_t pos = arg.find('=');
+        if (pos == string::npos) {
+            std::cerr << "Options must be key=value: " << arg << std::endl;
+            return 1;
+        }
+        options[arg.substr(0, pos)] = arg.substr(pos+1);
+    }
+    bool realtime = (option(options, "realtime", "0") == "1");
+
+    try {
+        size_t bytedepth;
+        vector<TraceRecord> records = read_trace(argv[1], bytedepth);
+        std::unique_ptr<LowtisConfig> config = create_config(options, bytedepth);
+        ImageService service(*config);
+
+        vector<double> latencies, recorded;
+        vector<char> buffer;
+        auto replay_start = std::chrono::steady_clock::now();
+        for (auto iter = records.begin(); iter != records.end(); ++iter) {
+            if (realtime) {
+                std::this_thread::sleep_until(replay_start +
+                        std::chrono::microseconds(iter->start_us));
+            }
+            buffer.resize(size_t(iter->width)*iter->height*bytedepth);
+            vector<int> location(iter->location, iter->location+3);
+
+            auto start = std::chrono::steady_clock::now();
+            if (iter->arbitrary) {
+                vector<double> dim1vec(iter->dim1vec, iter->dim1vec+3);
+                vector<double> dim2vec(iter->dim2vec, iter->dim2vec+3);
+                service.retrieve_arbimage(iter->width, iter->height, location,
+                        dim1vec, dim2vec, &buffer[0], iter->zoom, iter->centercut);
+            } else {
+                service.retrieve_image(iter->width, iter->height, location,
+                        &buffer[0], iter->zoom, iter->centercut);
+            }
+            latencies.push_back(std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start).count());
+            recorded.push_back(iter->duration_us / 1000.0);
+        }
+
+        ServiceStats stats = service.get_stats();
+        double hit_rate = stats.blocks ? double(stats.cache_hits) / stats.blocks : 0;
+        std::cout << "{\"requests\": " << records.size()
+            << ", \"latency_ms\": {\"p50\": " << percentile(latencies, 0.5)
+            << ", \"p90\": " << percentile(latencies, 0.9)
+            << ", \"p99\": " << percentile(latencies, 0.99)
+            << ", \"max\": " << percentile(latencies, 1.0) << "}"
+            << ", \"recorded_latency_ms\": {\"p50\": " << percentile(recorded, 0.5)
+            << ", \"p99\": " << percentile(recorded, 0.99) << "}"
+            << ", \"blocks\": " << stats.blocks
+            << ", \"cache_hit_rate\": " << hit_rate
+            << ", \"blocks_fetched\": " << stats.blocks_fetched
+            << ", \"bytes_fetched\": " << stats.bytes_fetched
+            << ", \"blocks_invalidated\": " << stats.blocks_invalidated << "}" << std::endl;
+    } catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -16,8 +16,16 @@ typedef std::shared_ptr<LowtisConfig> LowtisConfigPtr;
 struct LowtisConfig {
     LowtisConfig(size_t bytedepth_) : bytedepth(bytedepth_) {}
 
-    //! duration to keep items in cache (in seconds) (0 = no time limit)
+    //! duration to keep items in cache (in seconds) (0 = no time limit);
+    //! if the back-end reports data versions, only blocks cached before
+    //! the last version change expire
     unsigned int refresh_rate = 120;
+
+    //! time between reads of the data version (in milliseconds) on
+    //! back-ends that report one (e.g., the mutation id of a DVID
+    //! labelmap); the version is read in the background and requests
+    //! use the last version read (0 = read after every request)
+    unsigned int version_check_interval = 1000;
     
     //! cache limit (in MBs)
     // TODO: make dynamic?? 
@@ -26,7 +34,21 @@ struct LowtisConfig {
     //! uncompressed cache limit (in MBs) -- default off 
     unsigned int uncompressed_cache_size = 0;
 
-    //! default value of empty block
+    //! memory kept for reusing large buffers of decoded blocks (in MBs);
+    //! buffers leaving the uncompressed cache are reused for decoding lz4
+    //! blocks and for synthesized zoom levels (0 = off, also unused when
+    //! neither applies)
+    unsigned int buffer_pool_size = 0;
+
+    //! back new pooled buffers with transparent huge pages (Linux only)
+    bool buffer_pool_hugepages = false;
+
+    //! re-encode cached blocks that are slow to decode (gzip_labelarray,
+    //! jpeg) as lz4 on a background thread once they are reused; the
+    //! cache size limit still applies to the re-encoded blocks
+    bool transcode_blocks = false;
+
+    //! default value of empty block (stored in the lowest byte of a pixel)
     unsigned char emptyval = 0;    
 
     //! user calling program
@@ -38,11 +60,46 @@ struct LowtisConfig {
     //! size of middle region to fetch first (0,0) means make
     //! the call non-blocking
     std::tuple<int, int> centercut;
+
+    //! target time (in milliseconds) for a center cut request; when set,
+    //! the center size and the zoom of the low-resolution surround are
+    //! chosen from measured fetch times and cache contents, and the
+    //! center cut is skipped if the whole image should arrive in time
+    //! (0 = always use centercut)
+    double fovea_target_ms = 0;
+
+    //! max zoom levels the low-resolution surround can be coarser than
+    //! the center (when fovea_target_ms is set)
+    unsigned int fovea_max_zoom_offset = 3;
+
+    //! max zoom levels coarser than the requested zoom that a progressive
+    //! request fills the image from before refining it
+    unsigned int progressive_levels = 3;
+
+    //! width and height (in pixels) of the regions a progressive request
+    //! refines one at a time (0 = refine the whole image at once)
+    unsigned int progressive_tile_size = 256;
     
     //! enables prefetching for blocks
     //! (no-op, server side, local depending on the fetcher)
     bool enableprefetch = false;
     
+    //! percentile (0 to 1) of recent request times after which an
+    //! unfinished request is reissued on a second fetcher; the first
+    //! answer for each block is kept (0 = no hedged requests)
+    double hedge_percentile = 0;
+
+    //! number of retries for requests that fail with transient errors
+    unsigned int max_retries = 2;
+
+    //! delay before the first retry (in milliseconds); doubles each retry
+    unsigned int retry_backoff = 50;
+
+    //! number of consecutive zoom levels that can be built on the client
+    //! (mean for grayscale, mode for labels) from the next finer level
+    //! when the back-end does not store them (0 = disabled)
+    unsigned int synthesize_zoom_levels = 0;
+    
     // ?! add callback here
 
     virtual ~LowtisConfig() {}
@@ -59,6 +116,24 @@ struct DVIDConfig : public LowtisConfig {
     std::string datatypename;
     bool supervoxelview = false;
     bool usehighiopquery = true;
+
+    //! cost of one extra subvolume request measured in blocks; sparse
+    //! bounding boxes (labelblk or usehighiopquery off) are split into
+    //! dense subvolumes fetched in parallel when it saves more than this
+    double subvolume_request_cost = 4.0;
+
+    //! number of connections used for parallel block requests
+    unsigned int num_connections = 4;
+
+    //! max blocks per specific block request; larger requests are split
+    //! into chunks fetched in parallel (0 = single request)
+    unsigned int request_chunk_size = 64;
+
+    //! imagetile instance with jpeg xy tiles of the grayscale data; when
+    //! set, orthogonal views are built from tiles at the zoom levels the
+    //! instance stores, while oblique views and prefetch keep using
+    //! blocks (empty = blocks only)
+    std::string tile_instance;
 };
 
 struct DVIDGrayblkConfig : public DVIDConfig {
@@ -87,6 +162,75 @@ struct GoogleGrayblkConfig : public DVIDConfig {
         uncompressed_cache_size = 1000;
     }
     size_t isoblksize = 64;
+
+    //! block size along x, y and z for blocks that are not cubes, e.g.
+    //! (512, 512, 16) slabs for xy views ((0, 0, 0) = isoblksize cubes)
+    std::tuple<size_t, size_t, size_t> blockshape;
+
+    //! max adjacent blocks merged into one subvolume request
+    //! (1 = one request per block)
+    unsigned int max_request_blocks = 8;
+};
+
+/*!
+ * Configuration settings if using a local chunked volume.  The path
+ * is either a directory with one dataset file per zoom level
+ * (s0.chunks, s1.chunks, ...) or a single dataset file (zoom 0 only).
+*/
+struct LocalVolumeConfig : public LowtisConfig {
+    LocalVolumeConfig(size_t bytedepth_) : LowtisConfig(bytedepth_)
+    {
+        refresh_rate = 0;
+    }
+    std::string path;
+};
+
+/*!
+ * Configuration settings for the synthetic back-end, which generates
+ * deterministic blocks in process and simulates server latency,
+ * bandwidth and failures (for load testing without a server).
+ * A bytedepth of 1 gives grayscale, larger bytedepths give labels.
+*/
+struct SyntheticConfig : public LowtisConfig {
+    SyntheticConfig(size_t bytedepth_) : LowtisConfig(bytedepth_)
+    {
+        refresh_rate = 0;
+    }
+    size_t isoblksize = 64;
+
+    //! block size along x, y and z for blocks that are not cubes, e.g.
+    //! (512, 512, 16) slabs for xy views ((0, 0, 0) = isoblksize cubes)
+    std::tuple<size_t, size_t, size_t> blockshape;
+
+    //! block compression ("uncompressed", "lz4" or "jpeg" for bytedepth 1;
+    //! gzip_labelarray is not supported since libdvid cannot encode it)
+    std::string compression = "lz4";
+
+    //! number of zoom levels available
+    unsigned int num_levels = 8;
+
+    //! size of each label region (at zoom 0)
+    size_t label_size = 128;
+
+    //! time before the first block of a request arrives (in milliseconds)
+    double latency = 0;
+
+    //! max random change to the latency (in milliseconds)
+    double jitter = 0;
+
+    //! transfer rate of block data (in MB/s) (0 = no limit)
+    double bandwidth = 0;
+
+    //! fraction of requests that fail
+    double failure_rate = 0;
+
+    //! seed for latency jitter and failures
+    unsigned int seed = 0;
+
+    //! simulated label edits: the data version goes up every
+    //! mutation_interval milliseconds and each version relabels
+    //! 1/64 of the label regions (0 = data never changes)
+    double mutation_interval = 0;
 };
 
 }
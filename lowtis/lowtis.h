@@ -4,13 +4,194 @@
 #include <lowtis/LowtisConfig.h>
 
 #include <mutex>
+#include <condition_variable>
 #include <memory>
 #include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+
+namespace boost {
+class thread;
+}
 
 namespace lowtis {
 
+class Block;
 struct BlockCache;
 struct BlockFetch;
+class BlockTranscoder;
+class BufferPool;
+class FetchModel;
+class TraceWriter;
+struct TraceRecord;
+
+/*!
+ * Describes caller-owned memory that image data is written into.
+ * This allows writing directly into a larger surface (e.g., a texture
+ * atlas) with its own row pitch and pixel format.  A surface with
+ * only the buffer set is a packed width*height*bytedepth image.
+*/
+struct ImageSurface {
+    //! start of the surface memory
+    char* buffer = nullptr;
+
+    //! bytes between the starts of consecutive rows (0 = width*pixeldepth)
+    size_t rowstride = 0;
+
+    //! column of the surface where the image starts
+    unsigned int xoffset = 0;
+
+    //! row of the surface where the image starts
+    unsigned int yoffset = 0;
+
+    //! bytes written per pixel (0 = bytedepth); if smaller than the
+    //! bytedepth, only the lowest bytes are kept (e.g., uint64 -> uint32)
+    size_t pixeldepth = 0;
+};
+
+/*!
+ * Describes how one retrieve call was served.  The two passes of a
+ * fovea request run in parallel; their phase times and block counts
+ * are added together.
+*/
+struct RetrieveReport {
+    //! wall time of the call (in milliseconds)
+    double total_ms = 0;
+
+    //! time looking up blocks in the block cache (in milliseconds)
+    double cache_ms = 0;
+
+    //! time fetching or building missing blocks, including decoding
+    //! that overlaps with the fetch (in milliseconds)
+    double fetch_ms = 0;
+
+    //! time decoding blocks for the uncompressed cache (in milliseconds)
+    double decompress_ms = 0;
+
+    //! time writing pixels into the image (in milliseconds)
+    double composite_ms = 0;
+
+    //! time finding and requesting blocks to prefetch (in milliseconds)
+    double prefetch_ms = 0;
+
+    //! blocks needed for the image
+    unsigned int blocks = 0;
+
+    //! blocks found in the block cache
+    unsigned int cache_hits = 0;
+
+    //! cache hits that were already decoded in the uncompressed cache
+    unsigned int uncompressed_hits = 0;
+
+    //! blocks returned by the fetcher
+    unsigned int blocks_fetched = 0;
+
+    //! blocks built from the next finer zoom level
+    unsigned int blocks_synthesized = 0;
+
+    //! blocks with no data (written as emptyval)
+    unsigned int empty_blocks = 0;
+
+    //! compressed size of blocks returned by the fetcher
+    unsigned long long bytes_fetched = 0;
+
+    //! image was built from a high-resolution center and a low-resolution surround
+    bool fovea = false;
+
+    //! blocks around the image were requested for prefetch
+    bool prefetch = false;
+};
+
+/*!
+ * Region of the image that was (re)written by a progressive request.
+*/
+struct DirtyRect {
+    //! first column of the region (relative to the image)
+    unsigned int x = 0;
+
+    //! first row of the region (relative to the image)
+    unsigned int y = 0;
+
+    //! width of the region (in pixels)
+    unsigned int width = 0;
+
+    //! height of the region (in pixels)
+    unsigned int height = 0;
+
+    //! zoom level the region was rendered at
+    int zoom = 0;
+};
+
+/*!
+ * Progress of a progressive request passed to the caller's callback.
+*/
+struct ProgressUpdate {
+    //! regions written since the last update
+    std::vector<DirtyRect> rects;
+
+    //! no more updates follow for the request
+    bool done = false;
+
+    //! error message if the request failed (done is set)
+    std::string error;
+};
+
+//! called from a background thread after each pass of a progressive request
+typedef std::function<void(const ProgressUpdate&)> ProgressCallback;
+
+/*!
+ * One image of a multi-view request (see retrieve_views).
+*/
+struct ViewSpec {
+    //! width of the image (in pixels)
+    unsigned int width = 0;
+
+    //! height of the image (in pixels)
+    unsigned int height = 0;
+
+    //! offset of the image, or its center for an arbitrary plane
+    std::vector<int> location;
+
+    //! dim1 orientation vector of an arbitrary plane (empty for the fixed orientation)
+    std::vector<double> dim1vec;
+
+    //! dim2 orientation vector of an arbitrary plane
+    std::vector<double> dim2vec;
+
+    //! power of two zoom level (0 is full zoom)
+    int zoom = 0;
+
+    //! destination memory (views must not overlap)
+    ImageSurface surface;
+};
+
+/*!
+ * Block and data counts accumulated over retrieve calls.
+*/
+struct ServiceStats {
+    //! number of retrieve_image and retrieve_arbimage calls
+    unsigned long long requests = 0;
+
+    //! blocks needed to build the images
+    unsigned long long blocks = 0;
+
+    //! blocks found in the block cache
+    unsigned long long cache_hits = 0;
+
+    //! blocks returned by the fetcher
+    unsigned long long blocks_fetched = 0;
+
+    //! compressed size of blocks returned by the fetcher
+    unsigned long long bytes_fetched = 0;
+
+    //! cached blocks dropped because the data changed (only for
+    //! back-ends that report which blocks changed)
+    unsigned long long blocks_invalidated = 0;
+};
 
 /*!
  * Main class to access 2D image data.  Requests cannot be made
@@ -28,6 +209,11 @@ class ImageService {
     */ 
     ImageService(LowtisConfig& config_);
 
+    /*!
+     * Cancels a running progressive request.
+    */
+    ~ImageService();
+
     /*!
      * Retrieves image data for a fixed orientation (determined by the config file
      * if supported by lowtis DB driver .  This function is blocking and will
@@ -36,9 +222,24 @@ class ImageService {
      * \param offset offset of image
      * \param buffer preallocated image buffer (size: height*width*bytedepth)
      * \param zoom power of two zoom level (0 is full zoom)
+     * \param report filled with timing and block counts (if not null)
+    */ 
+    void retrieve_image(unsigned int width,
+        unsigned int height, std::vector<int> offset, char* buffer, int zoom=0, bool centercut=false,
+        RetrieveReport* report=0);
+
+    /*!
+     * Retrieves image data for a fixed orientation into a caller-owned
+     * surface.  Data is composited directly into the surface.
+     * \param viewport size of window
+     * \param offset offset of image
+     * \param surface destination memory, stride, position and pixel format
+     * \param zoom power of two zoom level (0 is full zoom)
+     * \param report filled with timing and block counts (if not null)
     */ 
     void retrieve_image(unsigned int width,
-        unsigned int height, std::vector<int> offset, char* buffer, int zoom=0, bool centercut=false);
+        unsigned int height, std::vector<int> offset, const ImageSurface& surface, int zoom=0, bool centercut=false,
+        RetrieveReport* report=0);
 
     /*!
      * Retrieves image data.  This function is blocking and will
@@ -50,10 +251,134 @@ class ImageService {
      * \param dim2vec gives dim2 orientation vector 
      * \param buffer preallocated image buffer (size: height*width*bytedepth)
      * \param zoom power of two zoom level (0 is full zoom)
+     * \param report filled with timing and block counts (if not null)
     */ 
     void retrieve_arbimage(unsigned int width,
         unsigned int height, std::vector<int> centerloc, std::vector<double> dim1vec,
-        std::vector<double> dim2vec, char* buffer, int zoom=0, bool centercut=false);
+        std::vector<double> dim2vec, char* buffer, int zoom=0, bool centercut=false,
+        RetrieveReport* report=0);
+
+    /*!
+     * Retrieves image data for an arbitrary plane into a caller-owned
+     * surface.  Data is composited directly into the surface.
+     * Note: dim1, dim2 must be orthogonal.
+     * \param viewport size of window
+     * \param centerloc location of image center
+     * \param dim1vec gives dim1 orientation vector 
+     * \param dim2vec gives dim2 orientation vector 
+     * \param surface destination memory, stride, position and pixel format
+     * \param zoom power of two zoom level (0 is full zoom)
+     * \param report filled with timing and block counts (if not null)
+    */ 
+    void retrieve_arbimage(unsigned int width,
+        unsigned int height, std::vector<int> centerloc, std::vector<double> dim1vec,
+        std::vector<double> dim2vec, const ImageSurface& surface, int zoom=0, bool centercut=false,
+        RetrieveReport* report=0);
+
+    /*!
+     * Retrieves a stack of consecutive orthogonal planes (increasing z
+     * from offset).  Each block covering the stack is looked up, fetched
+     * and decoded once and written into every plane it covers, which
+     * is much faster than retrieving the planes one at a time.
+     * \param width width of each plane
+     * \param height height of each plane
+     * \param depth number of planes (consecutive at the zoom level)
+     * \param offset offset of the first plane
+     * \param buffer preallocated buffer (size: depth*height*width*bytedepth)
+     *   holding the planes one after the other
+     * \param zoom power of two zoom level (0 is full zoom)
+     * \param report filled with timing and block counts (if not null)
+    */ 
+    void retrieve_image_stack(unsigned int width, unsigned int height, unsigned int depth,
+        std::vector<int> offset, char* buffer, int zoom=0, RetrieveReport* report=0);
+
+    /*!
+     * Retrieves a dense 3D subvolume through the block caches (e.g., a
+     * cutout around a point for analysis).  Blocks are fetched in one
+     * batch, decoded once and copied into the volume in parallel.
+     * \param dims size of the subvolume (x, y, z) at the zoom level
+     * \param offset offset of the subvolume (full resolution coordinates)
+     * \param buffer preallocated buffer (size: x*y*z*bytedepth) stored
+     *   with x varying fastest and z slowest
+     * \param zoom power of two zoom level (0 is full zoom)
+     * \param report filled with timing and block counts (if not null)
+    */ 
+    void retrieve_subvolume(std::vector<unsigned int> dims, std::vector<int> offset,
+        char* buffer, int zoom=0, RetrieveReport* report=0);
+
+    /*!
+     * Retrieves a stack of consecutive arbitrary planes one voxel apart
+     * along the normal (dim1vec x dim2vec).  Blocks are loaded and
+     * decoded once for the whole stack (see retrieve_image_stack).
+     * Note: dim1, dim2 must be orthogonal.
+     * \param width width of each plane
+     * \param height height of each plane
+     * \param depth number of planes (consecutive at the zoom level)
+     * \param centerloc location of the center of the first plane
+     * \param dim1vec gives dim1 orientation vector 
+     * \param dim2vec gives dim2 orientation vector 
+     * \param buffer preallocated buffer (size: depth*height*width*bytedepth)
+     *   holding the planes one after the other
+     * \param zoom power of two zoom level (0 is full zoom)
+     * \param report filled with timing and block counts (if not null)
+    */ 
+    void retrieve_arbimage_stack(unsigned int width, unsigned int height, unsigned int depth,
+        std::vector<int> centerloc, std::vector<double> dim1vec, std::vector<double> dim2vec,
+        char* buffer, int zoom=0, RetrieveReport* report=0);
+
+    /*!
+     * Retrieves several images in one call (e.g., the xy, xz and yz
+     * views through a point).  The union of the blocks of all views
+     * is looked up, fetched and decoded once for each zoom level and
+     * the views are then composited in parallel.  Views always use
+     * 3D blocks (see DVIDConfig::tile_instance).
+     * \param views images to retrieve
+     * \param report filled with timing and block counts for all views (if not null)
+    */ 
+    void retrieve_views(const std::vector<ViewSpec>& views, RetrieveReport* report=0);
+
+    /*!
+     * Starts filling the surface with image data for a fixed orientation
+     * and returns immediately.  The whole image is first filled from
+     * the finest cached (or otherwise the coarsest) zoom level below
+     * the requested one, and then refined region by region, starting
+     * at the center, as the blocks at the requested zoom arrive.  The
+     * callback gets the regions written after each pass.  The surface
+     * must stay valid until the update with done is set or the request
+     * is canceled.  A new progressive request cancels the previous one.
+     * \param viewport size of window
+     * \param offset offset of image
+     * \param surface destination memory, stride, position and pixel format
+     * \param zoom power of two zoom level (0 is full zoom)
+     * \param callback called with the regions written (must not throw)
+    */ 
+    void retrieve_image_progressive(unsigned int width, unsigned int height,
+        std::vector<int> offset, const ImageSurface& surface, int zoom,
+        ProgressCallback callback);
+
+    /*!
+     * Starts filling the surface with image data for an arbitrary
+     * plane and returns immediately (see retrieve_image_progressive).
+     * Note: dim1, dim2 must be orthogonal.
+     * \param viewport size of window
+     * \param centerloc location of image center
+     * \param dim1vec gives dim1 orientation vector 
+     * \param dim2vec gives dim2 orientation vector 
+     * \param surface destination memory, stride, position and pixel format
+     * \param zoom power of two zoom level (0 is full zoom)
+     * \param callback called with the regions written (must not throw)
+    */ 
+    void retrieve_arbimage_progressive(unsigned int width, unsigned int height,
+        std::vector<int> centerloc, std::vector<double> dim1vec,
+        std::vector<double> dim2vec, const ImageSurface& surface, int zoom,
+        ProgressCallback callback);
+
+    /*!
+     * Stops the running progressive request (if any) and waits for it
+     * to finish writing the current region.  No more updates are sent
+     * for the request.  Cannot be called from the callback.
+    */
+    void cancel_progressive();
 
     /*!
      * Pause future requests and asynchronous calls.
@@ -71,16 +396,139 @@ class ImageService {
     */
     void set_centercut(const std::tuple<int, int>& centercut);
 
+    /*!
+     * Logs each retrieve call (parameters and time taken) to a
+     * binary trace that can be replayed with lowtis_replay.
+     * \param path trace file (overwritten)
+    */
+    void start_recording(std::string path);
+
+    /*!
+     * Stops logging retrieve calls and closes the trace.
+    */
+    void stop_recording();
+
+    /*!
+     * Counts accumulated since creation or the last reset_stats.
+    */
+    ServiceStats get_stats();
+
+    /*!
+     * Sets all counts to zero.
+    */
+    void reset_stats();
+
   private:
     /*!
      * Retrieve image plane.  If no plane is defined, it just
      * defaults to the Z plane.
     */
     void _retrieve_image_fovea(unsigned int width,
-        unsigned int height, std::vector<int> offset, char* buffer, int zoom, bool centercut, std::vector<double> dim1step, std::vector<double> dim2step);
+        unsigned int height, std::vector<int> offset, ImageSurface surface, int zoom, bool centercut, std::vector<double> dim1step, std::vector<double> dim2step,
+        RetrieveReport* report);
 
     void _retrieve_image(unsigned int width,
-        unsigned int height, std::vector<int> offset, char* buffer, int zoom, std::shared_ptr<BlockFetch> curr_fetcher, std::vector<double> dim1step, std::vector<double> dim2step);
+        unsigned int height, std::vector<int> offset, ImageSurface surface, int zoom, std::shared_ptr<BlockFetch> curr_fetcher, std::vector<double> dim1step, std::vector<double> dim2step,
+        RetrieveReport* report);
+
+    /*!
+     * Looks up blocks in the caches, fetches (or synthesizes) the
+     * missing ones and decodes them into the uncompressed cache
+     * (if given).  Counts and phase times are added to the report.
+     * \param blocks blocks to load (replaced with the loaded blocks,
+     *   which are decoded if the uncompressed cache is given)
+     * \param zoom power of two zoom level of the blocks
+     * \param curr_fetcher fetcher used for missing blocks
+     * \param curr_cache cache of fetched blocks
+     * \param curr_uncompressed_cache cache of decoded blocks (can be null)
+    */
+    void _load_blocks(std::vector<Block>& blocks, int zoom,
+        std::shared_ptr<BlockFetch> curr_fetcher, std::shared_ptr<BlockCache> curr_cache,
+        std::shared_ptr<BlockCache> curr_uncompressed_cache, RetrieveReport* report);
+
+    /*!
+     * Builds blocks for a zoom level that the fetcher does not store
+     * by downsampling blocks from the next finer level.  Finer blocks
+     * come from the cache when possible and are cached once fetched.
+     * \param blocks blocks to build (data is set on return)
+     * \param zoom power of two zoom level of the blocks
+     * \param curr_fetcher fetcher used for the finer blocks
+     * \param levels number of levels that can still be built
+    */
+    void _synthesize_blocks(std::vector<Block>& blocks,
+        int zoom, std::shared_ptr<BlockFetch> curr_fetcher, unsigned int levels);
+
+    /*!
+     * Retrieves a stack of planes (offset is the corner of the first
+     * plane in full resolution coordinates).
+    */
+    void _retrieve_stack(unsigned int width, unsigned int height, unsigned int depth,
+        std::vector<int> offset, char* buffer, int zoom, std::vector<double> dim1step,
+        std::vector<double> dim2step, RetrieveReport* report);
+
+    /*!
+     * Runs a progressive request (on the progressive thread).
+    */
+    void _retrieve_progressive(unsigned int width, unsigned int height,
+        std::vector<int> offset, ImageSurface surface, int zoom, std::vector<double> dim1step,
+        std::vector<double> dim2step, ProgressCallback callback);
+
+    /*!
+     * Completes a trace record for a finished call and writes it.
+    */
+    void record_call(TraceRecord& record, unsigned int width, unsigned int height,
+        int zoom, bool centercut, std::chrono::steady_clock::time_point start_time);
+
+    /*!
+     * Adds the counts of a finished call to the service stats.
+    */
+    void update_stats(const RetrieveReport& report);
+
+    /*!
+     * Sizes the high-resolution center and picks the zoom of the
+     * surround so each should arrive within fovea_target_ms.  The
+     * configured center is kept until fetch times are measured.
+     * \param centercut set to false if the whole image should arrive in time
+     * \param cwidth set to center width
+     * \param cheight set to center height
+     * \param lowzoom set to zoom of the low-resolution surround
+    */
+    void plan_fovea(unsigned int width, unsigned int height, std::vector<int> offset,
+        int zoom, std::vector<double> dim1step, std::vector<double> dim2step,
+        bool& centercut, unsigned int& cwidth, unsigned int& cheight, int& lowzoom);
+
+    /*!
+     * Applies a change of the data version read by the version thread
+     * and asks for a new read every version_check_interval.  Changed
+     * blocks are dropped or, if the back-end cannot tell which blocks
+     * changed, the blocks cached so far expire after refresh_rate.
+     * Called with the class lock held before blocks are looked up
+     * (never waits for the server).
+    */
+    void validate_cache();
+
+    /*!
+     * Reads the data version when asked by validate_cache (runs on
+     * version_thread with its own fetcher).
+    */
+    void read_versions();
+
+    /*!
+     * Switches to the tile fetcher and tile caches for orthogonal views
+     * at zoom levels with tiles (see DVIDConfig::tile_instance).  Nothing
+     * changes otherwise.
+    */
+    void select_tiles(std::shared_ptr<BlockFetch>& curr_fetcher, std::shared_ptr<BlockCache>& curr_cache,
+        std::shared_ptr<BlockCache>& curr_uncompressed_cache, int zoom, const std::vector<double>& dim1step);
+
+    /*!
+     * Finds the fraction of blocks of an image missing from the cache.
+     * \param num_blocks set to number of blocks covering the image
+     * \return fraction of blocks not cached
+    */
+    double missing_fraction(unsigned int width, unsigned int height, std::vector<int> offset,
+        int zoom, std::shared_ptr<BlockFetch> curr_fetcher, std::vector<double> dim1step,
+        std::vector<double> dim2step, size_t& num_blocks);
     
     //! interface to fetch block data
     std::shared_ptr<BlockFetch> fetcher;
@@ -88,6 +536,10 @@ class ImageService {
     //! interface to fetch low-res block data
     std::shared_ptr<BlockFetch> fetcher2;
 
+    //! interfaces to fetch 2D tiles for orthogonal views (optional)
+    std::shared_ptr<BlockFetch> tile_fetcher;
+    std::shared_ptr<BlockFetch> tile_fetcher2;
+
     //! configuration for lowtis
     LowtisConfig config; 
 
@@ -102,6 +554,62 @@ class ImageService {
     
     //! holds decompressed block data cache (when decompression is slow)
     std::shared_ptr<BlockCache> uncompressed_cache;
+
+    //! holds tile data (tiles and blocks have overlapping coordinates)
+    std::shared_ptr<BlockCache> tile_cache;
+
+    //! holds decompressed tile data
+    std::shared_ptr<BlockCache> tile_uncompressed_cache;
+
+    //! recycles decoded block buffers (optional)
+    std::shared_ptr<BufferPool> buffer_pool;
+
+    //! back-end reports data versions (cached blocks do not expire)
+    bool versioned = false;
+
+    //! data version that the cached blocks are valid for
+    uint64_t data_version = 0;
+
+    //! reads data versions off the request path (versioned data only)
+    std::shared_ptr<BlockFetch> version_fetcher;
+    std::shared_ptr<boost::thread> version_thread;
+
+    //! guards the version state shared with version_thread
+    std::mutex version_mutex;
+    std::condition_variable version_condition;
+
+    //! last data version read by version_thread
+    uint64_t latest_version = 0;
+
+    //! time the data version was last read
+    std::chrono::steady_clock::time_point version_checked;
+
+    //! a read of the data version is wanted
+    bool version_requested = false;
+
+    //! stops version_thread
+    bool version_stop = false;
+
+    //! re-encodes reused blocks in the block cache (optional)
+    std::shared_ptr<BlockTranscoder> transcoder;
+
+    //! recent fetch times (for sizing the fovea)
+    std::shared_ptr<FetchModel> fetch_model;
+
+    //! trace of retrieve calls (when recording)
+    std::shared_ptr<TraceWriter> recorder;
+
+    //! counts over all requests
+    ServiceStats stats;
+
+    //! lock for stats (updated by concurrent fovea requests)
+    std::mutex stats_mutex;
+
+    //! thread running the current progressive request
+    std::shared_ptr<boost::thread> progressive_thread;
+
+    //! asks the progressive thread to stop
+    std::atomic<bool> progressive_cancel{false};
 };
 
 /*!
@@ -0,0 +1,154 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <boost/functional/hash.hpp>
+#include <libdvid/DVIDBlocks.h>
+#include <functional>
+#include <vector>
+
+namespace lowtis {
+struct BlockCoords {
+    int x = 0;
+    int y = 0;
+    int z = 0;
+    int zoom = 0;
+    bool operator==(const BlockCoords& coord2) const
+    {
+        return x == coord2.x && y == coord2.y && z == coord2.z && zoom == coord2.zoom;
+    }
+
+    //! orders by zoom, z, y and then x
+    bool operator<(const BlockCoords& coord2) const
+    {
+        if (zoom != coord2.zoom) {
+            return zoom < coord2.zoom;
+        }
+        if (z != coord2.z) {
+            return z < coord2.z;
+        }
+        if (y != coord2.y) {
+            return y < coord2.y;
+        }
+        return x < coord2.x;
+    }
+};
+}
+
+namespace std {
+template <>
+struct hash<lowtis::BlockCoords> {
+    std::size_t operator()(const lowtis::BlockCoords& coords) const
+    {
+        std::size_t seed = 0;
+        boost::hash_combine(seed, coords.x);
+        boost::hash_combine(seed, coords.y);
+        boost::hash_combine(seed, coords.z);
+        boost::hash_combine(seed, coords.zoom);
+        return seed;
+    }
+};
+
+}
+
+namespace lowtis {
+
+/*!
+ * Handle to the data of one block used inside lowtis (caches,
+ * decoding and compositing).  Coordinates are stored inline and the
+ * payload is shared, so handles are made and passed around without
+ * heap allocations.  Handles are move-only; clone() makes a second
+ * handle to the same payload.  Fetchers still use libdvid blocks,
+ * which are converted at the fetch boundary (see BlockFetch::wrap_block).
+*/
+class Block {
+  public:
+    typedef libdvid::DVIDCompressedBlock::CompressType CompressType;
+
+    Block() {}
+
+    /*!
+     * \param coords_ voxel offset of the block and its zoom level
+     * \param blocksize_ size of the block (x size for non-cubic blocks)
+     * \param typesize_ bytes per voxel
+     * \param compression_ encoding of data
+     * \param data_ block data (null if the block has no data)
+    */
+    Block(BlockCoords coords_, size_t blocksize_, size_t typesize_,
+            CompressType compression_, libdvid::BinaryDataPtr data_) :
+        coords(coords_), blocksize(blocksize_), typesize(typesize_),
+        compression(compression_), data(data_) {}
+
+    Block(Block&&) = default;
+    Block& operator=(Block&&) = default;
+    Block(const Block&) = delete;
+    Block& operator=(const Block&) = delete;
+
+    //! another handle to the same data
+    Block clone() const
+    {
+        return Block(coords, blocksize, typesize, compression, data);
+    }
+
+    //! libdvid block for the fetchers (allocates the offset)
+    libdvid::DVIDCompressedBlock to_dvid() const
+    {
+        std::vector<int> offset(3);
+        offset[0] = coords.x;
+        offset[1] = coords.y;
+        offset[2] = coords.z;
+        return libdvid::DVIDCompressedBlock(data, offset, blocksize, typesize, compression);
+    }
+
+    const BlockCoords& get_coords() const
+    {
+        return coords;
+    }
+
+    const libdvid::BinaryDataPtr& get_data() const
+    {
+        return data;
+    }
+
+    void set_data(libdvid::BinaryDataPtr data_)
+    {
+        data = data_;
+    }
+
+    //! size of data in bytes (0 if no data)
+    size_t get_datasize() const
+    {
+        return data ? data->length() : 0;
+    }
+
+    size_t get_blocksize() const
+    {
+        return blocksize;
+    }
+
+    size_t get_typesize() const
+    {
+        return typesize;
+    }
+
+    CompressType get_compression() const
+    {
+        return compression;
+    }
+
+  private:
+    BlockCoords coords;
+    unsigned int blocksize = 0;
+    unsigned int typesize = 0;
+    CompressType compression = libdvid::DVIDCompressedBlock::uncompressed;
+    libdvid::BinaryDataPtr data;
+};
+
+/*!
+ * Receives blocks from a streaming fetch (see BlockFetch::stream_blocks).
+ * The handler can keep the block by moving it.
+*/
+typedef std::function<void (Block&)> BlockHandler;
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include "BlockCache.h"
+#include "BufferPool.h"
 #include <vector>
+#include <cstring>
+#include <utility>
 
 using namespace lowtis;
 using namespace libdvid;
@@ -15,6 +18,12 @@ void BlockCache::set_timer(int seconds)
     gmutex.unlock();
 }
 
+void BlockCache::set_timer_cutoff(time_t cutoff)
+{
+    std::lock_guard<std::mutex> lock(gmutex);
+    timer_cutoff = cutoff;
+}
+
 void BlockCache::set_max_size(size_t max_size_)
 {
     gmutex.lock();
@@ -22,17 +31,74 @@ void BlockCache::set_max_size(size_t max_size_)
     gmutex.unlock();
 }
 
-bool BlockCache::retrieve_block(BlockCoords coords, DVIDCompressedBlock& block)
+void BlockCache::set_pool(std::shared_ptr<BufferPool> pool_)
+{
+    gmutex.lock();
+    pool = pool_;
+    gmutex.unlock();
+}
+
+std::shared_ptr<BufferPool> BlockCache::get_pool()
+{
+    std::lock_guard<std::mutex> lock(gmutex);
+    return pool;
+}
+
+void BlockCache::flush()
+{
+    gmutex.lock();
+    for (auto iter = cache.begin(); iter != cache.end(); ++iter) {
+        recycle(iter->second.block);
+    }
+    cache.clear();
+    curr_cache_size = 0;
+    gmutex.unlock();
+}
+
+size_t BlockCache::remove_blocks(std::function<bool (const BlockCoords&)> changed)
+{
+    std::lock_guard<std::mutex> lock(gmutex);
+    size_t num_removed = 0;
+    for (auto cache_iter = cache.begin(); cache_iter != cache.end();) {
+        if (changed(cache_iter->first)) {
+            if (cache_iter->second.block.get_data()) {
+                curr_cache_size -= cache_iter->second.block.get_datasize();
+            }
+            recycle(cache_iter->second.block);
+            cache_iter = cache.erase(cache_iter);
+            ++num_removed;
+        } else {
+            ++cache_iter;
+        }
+    }
+    return num_removed;
+}
+
+// caller must lock cache
+void BlockCache::recycle(Block& block)
+{
+    if (!pool) {
+        return;
+    }
+    // the pool only takes buffers that are no longer referenced
+    BinaryDataPtr data = block.get_data();
+    block.set_data(BinaryDataPtr());
+    pool->release(data);
+}
+
+bool BlockCache::retrieve_block(BlockCoords coords, Block& block,
+        bool* transcoded)
 {
     gmutex.lock();
     bool found = false;
     auto cache_iter = cache.find(coords);
     if (cache_iter != cache.end()) {
-        time_t current_time = time(0);
-        if ( !time_limit ||
-             ((current_time - cache_iter->second.timestamp) < time_limit) ) {
-            block = cache_iter->second.block;
+        if (!expired(cache_iter->second, time(0))) {
+            block = cache_iter->second.block.clone();
             found = true;
+            if (transcoded) {
+                *transcoded = cache_iter->second.transcoded;
+            }
         }   
     }
     
@@ -40,8 +106,18 @@ bool BlockCache::retrieve_block(BlockCoords coords, DVIDCompressedBlock& block)
     return found;
 
 }
+
+bool BlockCache::has_block(BlockCoords coords)
+{
+    std::lock_guard<std::mutex> lock(gmutex);
+    auto cache_iter = cache.find(coords);
+    if (cache_iter == cache.end()) {
+        return false;
+    }
+    return !expired(cache_iter->second, time(0));
+}
     
-void BlockCache::set_block(DVIDCompressedBlock block, int zoom)
+void BlockCache::set_block(const Block& block)
 {
     gmutex.lock();
    
@@ -51,14 +127,15 @@ void BlockCache::set_block(DVIDCompressedBlock block, int zoom)
     }
     BlockData bdata;
     bdata.timestamp = time(0); 
-    bdata.block = block; 
-    BlockCoords coords;
-    vector<int> offset = block.get_offset();
-    coords.x = offset[0];
-    coords.y = offset[1];
-    coords.z = offset[2];
-    coords.zoom = zoom;
-    cache[coords] = bdata;
+    bdata.block = block.clone(); 
+
+    // a refreshed block replaces the old entry
+    BlockData& entry = cache[block.get_coords()];
+    if (entry.block.get_data()) {
+        curr_cache_size -= entry.block.get_datasize();
+        recycle(entry.block);
+    }
+    entry = std::move(bdata);
     
     // check if cache is full
     if (curr_cache_size/1000000 > max_size) {
@@ -68,6 +145,42 @@ void BlockCache::set_block(DVIDCompressedBlock block, int zoom)
     gmutex.unlock();
 }
 
+bool BlockCache::replace_block(BlockCoords coords, const Block& original, Block block)
+{
+    gmutex.lock();
+    auto cache_iter = cache.find(coords);
+    if ((cache_iter == cache.end()) ||
+            (cache_iter->second.block.get_data() != original.get_data())) {
+        gmutex.unlock();
+        return false;
+    }
+
+    if (original.get_data()) {
+        curr_cache_size -= original.get_datasize();
+    }
+    if (block.get_data()) {
+        curr_cache_size += block.get_datasize();
+    }
+    recycle(cache_iter->second.block);
+    cache_iter->second.block = std::move(block);
+    cache_iter->second.transcoded = true;
+
+    // re-encoded blocks can be larger
+    if (curr_cache_size/1000000 > max_size) {
+        shrink_cache();
+    }
+
+    gmutex.unlock();
+    return true;
+}
+
+// caller must lock cache
+bool BlockCache::expired(const BlockData& data, time_t current_time) const
+{
+    return time_limit && (data.timestamp <= timer_cutoff) &&
+        ((current_time - data.timestamp) >= time_limit);
+}
+
 // caller must lock cache
 void BlockCache::shrink_cache()
 {
@@ -90,6 +203,7 @@ void BlockCache::remove_old_entries(time_t time_threshold)
             if (cache_iter->second.block.get_data()) {
                 curr_cache_size -= cache_iter->second.block.get_datasize();
             }
+            recycle(cache_iter->second.block);
             cache_iter = cache.erase(cache_iter);
         } else {
             ++cache_iter;
@@ -98,3 +212,27 @@ void BlockCache::remove_old_entries(time_t time_threshold)
 }
 
 
+
+Block lowtis::make_uniform_block(const unsigned char* value,
+        BlockCoords coords, size_t blocksize, size_t typesize)
+{
+    BinaryDataPtr data = BinaryData::create_binary_data(
+            reinterpret_cast<const char*>(value), typesize);
+    return Block(coords, blocksize, typesize, DVIDCompressedBlock::uncompressed, data);
+}
+
+bool lowtis::is_uniform_block(const Block& block)
+{
+    size_t blocksize = block.get_blocksize();
+    return block.get_data() && (blocksize*blocksize*blocksize > 1) &&
+        (block.get_datasize() == block.get_typesize());
+}
+
+bool lowtis::is_uniform_data(const unsigned char* data, size_t length, size_t typesize)
+{
+    if (length <= typesize) {
+        return true;
+    }
+    // the buffer is uniform iff it equals itself shifted by one voxel
+    return memcmp(data, data + typesize, length - typesize) == 0;
+}
@@ -2,50 +2,59 @@
 #define BLOCKCACHE_H
 
 #include <unordered_map>
-#include <boost/functional/hash.hpp>
 #include <functional>
 #include <time.h>
 #include <mutex>
 #include <libdvid/DVIDBlocks.h>
+#include <memory>
+#include <limits>
+#include "Block.h"
 
 namespace lowtis {
-struct BlockCoords {
-    int x = 0;
-    int y = 0;
-    int z = 0;
-    int zoom = 0;
-    bool operator==(const BlockCoords& coord2) const
-    {
-        return x == coord2.x && y == coord2.y && z == coord2.z && zoom == coord2.zoom;
-    }
-};
-}
-
-namespace std {
-template <>
-struct hash<lowtis::BlockCoords> {
-    std::size_t operator()(const lowtis::BlockCoords& coords) const
-    {
-        std::size_t seed = 0;
-        boost::hash_combine(seed, coords.x);
-        boost::hash_combine(seed, coords.y);
-        boost::hash_combine(seed, coords.z);
-        boost::hash_combine(seed, coords.zoom);
-        return seed; 
-    }
-};
-
-}
 
-namespace lowtis {
+class BufferPool;
 
 struct BlockData {
     //BlockData() = default;
-    //! hold actual compressed data TODO: make custom chunk object
-    libdvid::DVIDCompressedBlock block;
+    //! hold actual compressed data
+    Block block;
     time_t timestamp;
+
+    //! block was re-encoded after insertion (see BlockTranscoder)
+    bool transcoded = false;
 };
 
+/*!
+ * Creates a block that stores a single voxel value for a block
+ * whose voxels all have that value.  The block is stored as
+ * uncompressed data of exactly one voxel (typesize bytes), which
+ * no real compressed or decoded block can have.
+ * \param value pointer to typesize bytes of voxel data
+ * \param coords coordinates of block
+ * \param blocksize size of block
+ * \param typesize bytes per voxel
+ * \return block holding only the voxel value
+*/
+Block make_uniform_block(const unsigned char* value,
+        BlockCoords coords, size_t blocksize, size_t typesize);
+
+/*!
+ * Checks whether the block was created by make_uniform_block.
+ * \param block block to check
+ * \return true if the data is a single voxel value
+*/
+bool is_uniform_block(const Block& block);
+
+/*!
+ * Checks whether the voxels in a decoded buffer all have
+ * the same value.
+ * \param data decoded voxel data
+ * \param length size of data in bytes
+ * \param typesize bytes per voxel
+ * \return true if every voxel equals the first voxel
+*/
+bool is_uniform_data(const unsigned char* data, size_t length, size_t typesize);
+
 /*!
  * Caches chunks of image data.  This class is responsible
  * for fast indexing of data, evicting old cache data, limiting
@@ -67,26 +76,80 @@ class BlockCache {
     */
     void set_timer(int seconds);
 
+    /*!
+     * Limits the timer to blocks cached at or before a time (e.g., the
+     * last change of versioned data); later blocks do not expire.  By
+     * default the timer applies to every block.
+     * \param cutoff latest cache time of blocks that can expire
+    */
+    void set_timer_cutoff(time_t cutoff);
+
     /*!
      * Sets max size of cache
      * \param max_size_ size limit in MBs
     */ 
     void set_max_size(size_t max_size_);
 
+    /*!
+     * Sets a pool that takes back the data of removed blocks
+     * (for caches of decoded blocks).
+     * \param pool_ buffer pool (null to free data normally)
+    */
+    void set_pool(std::shared_ptr<BufferPool> pool_);
+
+    /*!
+     * Pool set for the cache (null if none).
+    */
+    std::shared_ptr<BufferPool> get_pool();
+
     /*!
      * Empty the cache.
     */
-    void flush() { cache.clear(); }
+    void flush();
+
+    /*!
+     * Removes the blocks that match a condition (e.g., blocks that
+     * changed in a new version of the data).
+     * \param changed true for blocks to remove
+     * \return number of blocks removed
+    */
+    size_t remove_blocks(std::function<bool (const BlockCoords&)> changed);
         
     /*!
      * Fetches a block if it exists and is recent as defined
      * by the user specified time limit.
      * \param coords coordinates for block
-     * \param block value (if found) for block
+     * \param block handle (if found) to the cached block
+     * \param transcoded set to whether the block was re-encoded (if not null)
      * \return true if found block, false otherwise
     */
-    bool retrieve_block(BlockCoords coords, libdvid::DVIDCompressedBlock& block);
-    void set_block(libdvid::DVIDCompressedBlock block, int zoom);
+    bool retrieve_block(BlockCoords coords, Block& block,
+            bool* transcoded = 0);
+
+    /*!
+     * Checks whether a recent block is cached without retrieving it
+     * (for estimates that should not count as a use of the block).
+     * \param coords coordinates for block
+     * \return true if retrieve_block would find the block
+    */
+    bool has_block(BlockCoords coords);
+
+    /*!
+     * Caches a handle to the block (at the coordinates of the block).
+     * \param block block to cache
+    */
+    void set_block(const Block& block);
+
+    /*!
+     * Replaces a cached block with a re-encoded copy.  Nothing is
+     * replaced if the entry was evicted or refreshed since the
+     * original was retrieved.  The timestamp is kept.
+     * \param coords coordinates for block
+     * \param original block data that was re-encoded
+     * \param block re-encoded block
+     * \return true if the block was replaced
+    */
+    bool replace_block(BlockCoords coords, const Block& original, Block block);
 
   private:
     
@@ -96,10 +159,23 @@ class BlockCache {
     */
     void remove_old_entries(time_t time_threshold);
     
+    /*!
+     * Checks whether a cached block has expired.
+     * \param data cache entry
+     * \param current_time time of the check
+    */
+    bool expired(const BlockData& data, time_t current_time) const;
+
     /*!
      * Shrink size of cache in half.
     */
     void shrink_cache();
+
+    /*!
+     * Returns the data of a removed block to the pool (if any).
+     * \param block block no longer in the cache
+    */
+    void recycle(Block& block);
     
     //!! cache of blocks (indexed by coordinates)
     std::unordered_map<BlockCoords, BlockData> cache;
@@ -113,6 +189,12 @@ class BlockCache {
     //! time limit in seconds till eviction (0 is no eviction)
     size_t time_limit = 0;
 
+    //! only blocks cached at or before this time can expire
+    time_t timer_cutoff = std::numeric_limits<time_t>::max();
+
+    //! takes back data of removed blocks (optional)
+    std::shared_ptr<BufferPool> pool;
+
     std::mutex gmutex;
 
 };
@@ -1,35 +1,143 @@
 #include "BlockFetch.h"
-#include "BlockCache.h"
+#include "BufferPool.h"
 #include <libdvid/DVIDNodeService.h>
 #include <unordered_map>
 #include <unordered_set>
 #include <cmath>
+#include <algorithm>
+#include <array>
 
 using namespace lowtis; using namespace libdvid;
 using std::string; using std::vector; using std::unordered_map;
-using std::round; using std::unordered_set;
+using std::round; using std::unordered_set; using std::array;
 
-vector<libdvid::DVIDCompressedBlock> BlockFetch::intersecting_blocks(
+namespace {
+
+// position of a within a block of size b (also for negative a)
+inline int floor_mod(int a, int b)
+{
+    int mod = a % b;
+    return (mod < 0) ? (mod + b) : mod;
+}
+
+}
+
+bool lowtis::is_jpeg_data(const libdvid::BinaryDataPtr& data)
+{
+    if (!data || (data->length() < 2)) {
+        return false;
+    }
+    const unsigned char* raw = data->get_raw();
+    return (raw[0] == 0xFF) && (raw[1] == 0xD8);
+}
+
+libdvid::BinaryDataPtr BlockFetch::uncompressed_data(const Block& block,
+        BufferPool* pool) const
+{
+    const libdvid::BinaryDataPtr& data = block.get_data();
+    if (block.get_compression() == libdvid::DVIDCompressedBlock::uncompressed) {
+        return data;
+    }
+    size_t rawsize = block_voxels() * block.get_typesize();
+    if (block.get_compression() == libdvid::DVIDCompressedBlock::lz4) {
+        if (pool) {
+            // lz4 can decode into a given buffer (nothing is returned then)
+            libdvid::BinaryDataPtr rawdata = pool->acquire(rawsize, false);
+            libdvid::BinaryData::decompress_lz4(data, rawsize,
+                    &(rawdata->get_data()[0]), rawsize);
+            return rawdata;
+        }
+        if (!cubic_blocks()) {
+            return libdvid::BinaryData::decompress_lz4(data, rawsize);
+        }
+    }
+    if (!cubic_blocks() && (block.get_compression() == libdvid::DVIDCompressedBlock::jpeg)) {
+        unsigned int width, height;
+        return libdvid::BinaryData::decompress_jpeg(data, width, height);
+    }
+    return block.to_dvid().get_uncompressed_data();
+}
+
+Block BlockFetch::wrap_block(const libdvid::DVIDCompressedBlock& block, int zoom) const
+{
+    vector<int> offset = block.get_offset();
+    BlockCoords coords;
+    coords.x = offset[0];
+    coords.y = offset[1];
+    coords.z = offset[2];
+    coords.zoom = zoom;
+
+    libdvid::BinaryDataPtr data = block.get_data();
+    libdvid::DVIDCompressedBlock::CompressType ctype = compression_type;
+    if (data && ((data->length() == block_voxels() * block.get_typesize()) ||
+                (data->length() == block.get_typesize()))) {
+        ctype = libdvid::DVIDCompressedBlock::uncompressed;
+    } else if (data && (ctype == libdvid::DVIDCompressedBlock::jpeg) && !is_jpeg_data(data)) {
+        ctype = libdvid::DVIDCompressedBlock::lz4;
+    }
+    return Block(coords, block.get_blocksize(), block.get_typesize(), ctype, data);
+}
+
+void BlockFetch::fetch_blocks(vector<Block>& blocks, int zoom)
+{
+    vector<libdvid::DVIDCompressedBlock> request;
+    request.reserve(blocks.size());
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        request.push_back(iter->to_dvid());
+    }
+    extract_specific_blocks(request, zoom);
+
+    blocks.clear();
+    for (auto iter = request.begin(); iter != request.end(); ++iter) {
+        blocks.push_back(wrap_block(*iter, zoom));
+    }
+}
+
+void BlockFetch::stream_blocks(const vector<Block>& blocks, int zoom, BlockHandler handler)
+{
+    vector<libdvid::DVIDCompressedBlock> request;
+    request.reserve(blocks.size());
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        request.push_back(iter->to_dvid());
+    }
+    stream_specific_blocks(request, zoom, [&](const libdvid::DVIDCompressedBlock& block) {
+        Block wrapped = wrap_block(block, zoom);
+        handler(wrapped);
+    });
+}
+
+void BlockFetch::prefetch(const vector<Block>& blocks, int zoom)
+{
+    vector<libdvid::DVIDCompressedBlock> request;
+    request.reserve(blocks.size());
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        request.push_back(iter->to_dvid());
+    }
+    prefetch_blocks(request, zoom);
+}
+
+vector<Block> BlockFetch::intersecting_blocks(
         vector<unsigned int> dims, vector<int> offset, vector<double> dim1step,
-        vector<double> dim2step, vector<double> dim3step)
+        vector<double> dim2step, vector<double> dim3step, int zoom)
 {  
-    // ?! temporary simplifying hack
-    size_t isoblksize = std::get<0>(blocksize);
+    int bsize[3] = {int(std::get<0>(blocksize)), int(std::get<1>(blocksize)),
+        int(std::get<2>(blocksize))};
     
-    vector<libdvid::DVIDCompressedBlock> blocks;
+    vector<Block> blocks;
     libdvid::BinaryDataPtr emptyptr(0);
 
     // need special loop to handle arbitrary plane
     // (more computationally expensive)
     if (!dim1step.empty()) {
-        // duplicate blocks could be found
-        // when checking arbitrary angles
-        unordered_set<BlockCoords> foundblocks;
+        // duplicate blocks could be found when checking arbitrary
+        // angles; each row crosses a block only once, so only rows
+        // that differ from the previous row are collected and
+        // duplicates are removed by sorting (no hash set nodes)
+        vector<BlockCoords> foundblocks;
+        vector<BlockCoords> rowblocks;
+        size_t prevrow_start = 0;
         
-        BlockCoords savedcoords;
-        savedcoords.x = INT_MAX;
         vector<double> toffset(3, 0);
-        vector<int> toffset2(3, 0);
         for (int z = 0; z < dims[2]; ++z) {
             // set offset
             for (size_t i = 0; i < toffset.size(); ++i) {
@@ -37,40 +145,35 @@ vector<libdvid::DVIDCompressedBlock> BlockFetch::intersecting_blocks(
             }
 
             for (int y = 0; y < dims[1]; ++y) {
+                rowblocks.clear();
                 for (int x = 0; x < dims[0]; ++x) {
                     // find blocks for arbitrary angle
-                    // avoid adding duplicate blocks
                     BlockCoords coords;
                     coords.x = static_cast<int>(toffset[0] + 0.5);
                     coords.y = static_cast<int>(toffset[1] + 0.5);
                     coords.z = static_cast<int>(toffset[2] + 0.5);
 
-                    int xshift = coords.x % isoblksize;
-                    int yshift = coords.y % isoblksize;
-                    int zshift = coords.z % isoblksize;
-
-                    coords.x -= xshift;
-                    coords.y -= yshift;
-                    coords.z -= zshift;
-
-                    // if same as previous block, do not even lookup 
-                    if (!(savedcoords == coords)) {
-                        std::pair<unordered_set<BlockCoords>::iterator, bool> result = foundblocks.insert(coords);
-                        if (result.second) {
-                            toffset2[0] = coords.x;
-                            toffset2[1] = coords.y;
-                            toffset2[2] = coords.z;
-                            libdvid::DVIDCompressedBlock cblock(emptyptr, toffset2,
-                                    isoblksize, bytedepth, compression_type);
-                            blocks.push_back(cblock);
-                        }
-                        savedcoords = coords;
+                    coords.x -= floor_mod(coords.x, bsize[0]);
+                    coords.y -= floor_mod(coords.y, bsize[1]);
+                    coords.z -= floor_mod(coords.z, bsize[2]);
+
+                    // if same as previous block, do not even store
+                    if (rowblocks.empty() || !(rowblocks.back() == coords)) {
+                        rowblocks.push_back(coords);
                     }
 
                     toffset[0] += dim1step[0];
                     toffset[1] += dim1step[1];
                     toffset[2] += dim1step[2];
                 }
+
+                // keep rows that cross a different set of blocks
+                if ((rowblocks.size() != (foundblocks.size() - prevrow_start)) ||
+                        !std::equal(rowblocks.begin(), rowblocks.end(),
+                            foundblocks.begin() + prevrow_start)) {
+                    prevrow_start = foundblocks.size();
+                    foundblocks.insert(foundblocks.end(), rowblocks.begin(), rowblocks.end());
+                }
                     
                 toffset[0] -= (dims[0]*dim1step[0]);
                 toffset[1] -= (dims[0]*dim1step[1]);
@@ -81,45 +184,39 @@ vector<libdvid::DVIDCompressedBlock> BlockFetch::intersecting_blocks(
                 toffset[2] += (dim2step[2]);
             }
         }
+
+        std::sort(foundblocks.begin(), foundblocks.end());
+        foundblocks.erase(std::unique(foundblocks.begin(), foundblocks.end()), foundblocks.end());
+        blocks.reserve(foundblocks.size());
+        for (auto iter = foundblocks.begin(); iter != foundblocks.end(); ++iter) {
+            BlockCoords bcoords = *iter;
+            bcoords.zoom = zoom;
+            blocks.push_back(Block(bcoords, bsize[0], bytedepth,
+                        compression_type, emptyptr));
+        }
     } else {
         // make block aligned dims and offset
-        int modoffset = offset[0] % isoblksize;
-        offset[0] -= modoffset;
-        dims[0] += modoffset;
-
-        modoffset = offset[1] % isoblksize;
-        offset[1] -= modoffset;
-        dims[1] += modoffset;
-
-        modoffset = offset[2] % isoblksize;
-        offset[2] -= modoffset;
-        dims[2] += modoffset;
-
-        int modsize = dims[0] % isoblksize;
-        if (modsize != 0) {
-            dims[0] += (isoblksize - modsize);
-        } 
-
-        modsize = dims[1] % isoblksize;
-        if (modsize != 0) {
-            dims[1] += (isoblksize - modsize);
-        } 
-
-        modsize = dims[2] % isoblksize;
-        if (modsize != 0) {
-            dims[2] += (isoblksize - modsize);
-        } 
-
-        vector<int> toffset(3, 0);
-        for (int z = 0; z < (dims[2]/isoblksize); ++z) {
-            for (int y = 0; y < (dims[1]/isoblksize); ++y) {
-                for (int x = 0; x < (dims[0]/isoblksize); ++x) {
-                    toffset[0] = offset[0] + x * isoblksize;
-                    toffset[1] = offset[1] + y * isoblksize;
-                    toffset[2] = offset[2] + z * isoblksize;
-                    libdvid::DVIDCompressedBlock cblock(emptyptr, toffset,
-                            isoblksize, bytedepth, compression_type);
-                    blocks.push_back(cblock);
+        for (int i = 0; i < 3; ++i) {
+            int modoffset = floor_mod(offset[i], bsize[i]);
+            offset[i] -= modoffset;
+            dims[i] += modoffset;
+
+            int modsize = dims[i] % bsize[i];
+            if (modsize != 0) {
+                dims[i] += (bsize[i] - modsize);
+            } 
+        }
+
+        BlockCoords coords;
+        coords.zoom = zoom;
+        for (int z = 0; z < (dims[2]/bsize[2]); ++z) {
+            for (int y = 0; y < (dims[1]/bsize[1]); ++y) {
+                for (int x = 0; x < (dims[0]/bsize[0]); ++x) {
+                    coords.x = offset[0] + x * bsize[0];
+                    coords.y = offset[1] + y * bsize[1];
+                    coords.z = offset[2] + z * bsize[2];
+                    blocks.push_back(Block(coords, bsize[0], bytedepth,
+                                compression_type, emptyptr));
                 }
             }
         }
@@ -127,3 +224,112 @@ vector<libdvid::DVIDCompressedBlock> BlockFetch::intersecting_blocks(
 
     return blocks;
 }
+
+namespace {
+
+typedef array<int, 3> GridPoint;
+
+BlockBox bounding_box(vector<GridPoint>::const_iterator begin,
+        vector<GridPoint>::const_iterator end)
+{
+    BlockBox box;
+    for (int i = 0; i < 3; ++i) {
+        box.minpt[i] = INT_MAX;
+        box.maxpt[i] = INT_MIN;
+    }
+    for (auto iter = begin; iter != end; ++iter) {
+        for (int i = 0; i < 3; ++i) {
+            box.minpt[i] = std::min(box.minpt[i], (*iter)[i]);
+            box.maxpt[i] = std::max(box.maxpt[i], (*iter)[i]+1);
+        }
+    }
+    return box;
+}
+
+// recursively split points while a split lowers the total cost
+void split_box(vector<GridPoint>& points, double request_cost, vector<BlockBox>& boxes)
+{
+    BlockBox box = bounding_box(points.begin(), points.end());
+    double cost = request_cost + box.volume();
+    if (box.volume() == points.size()) {
+        boxes.push_back(box);
+        return;
+    }
+
+    int bestaxis = -1;
+    size_t bestpos = 0;
+    double bestcost = cost;
+    vector<BlockBox> suffix(points.size());
+    for (int axis = 0; axis < 3; ++axis) {
+        std::sort(points.begin(), points.end(),
+                [axis](const GridPoint& p1, const GridPoint& p2) { return p1[axis] < p2[axis]; });
+
+        // bounding boxes of every suffix for constant-time split costs
+        suffix[points.size()-1] = bounding_box(points.end()-1, points.end());
+        for (size_t pos = points.size()-1; pos > 0; --pos) {
+            suffix[pos-1] = suffix[pos];
+            for (int i = 0; i < 3; ++i) {
+                suffix[pos-1].minpt[i] = std::min(suffix[pos-1].minpt[i], points[pos-1][i]);
+                suffix[pos-1].maxpt[i] = std::max(suffix[pos-1].maxpt[i], points[pos-1][i]+1);
+            }
+        }
+
+        BlockBox prefix = bounding_box(points.begin(), points.begin()+1);
+        for (size_t pos = 1; pos < points.size(); ++pos) {
+            // only split between different planes
+            if (points[pos][axis] != points[pos-1][axis]) {
+                double splitcost = 2*request_cost + prefix.volume() + suffix[pos].volume();
+                if (splitcost < bestcost) {
+                    bestcost = splitcost;
+                    bestaxis = axis;
+                    bestpos = pos;
+                }
+            }
+            for (int i = 0; i < 3; ++i) {
+                prefix.minpt[i] = std::min(prefix.minpt[i], points[pos][i]);
+                prefix.maxpt[i] = std::max(prefix.maxpt[i], points[pos][i]+1);
+            }
+        }
+    }
+
+    if (bestaxis < 0) {
+        boxes.push_back(box);
+        return;
+    }
+
+    std::sort(points.begin(), points.end(),
+            [bestaxis](const GridPoint& p1, const GridPoint& p2) { return p1[bestaxis] < p2[bestaxis]; });
+    vector<GridPoint> points2(points.begin()+bestpos, points.end());
+    points.resize(bestpos);
+    split_box(points, request_cost, boxes);
+    split_box(points2, request_cost, boxes);
+}
+
+}
+
+vector<BlockBox> BlockFetch::decompose_blocks(
+        const vector<libdvid::DVIDCompressedBlock>& blocks, double request_cost)
+{
+    vector<BlockBox> boxes;
+    if (blocks.empty()) {
+        return boxes;
+    }
+
+    // convert to block coordinates (ignore duplicates)
+    vector<GridPoint> points;
+    unordered_set<BlockCoords> foundblocks;
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        vector<int> offset = iter->get_offset();
+        BlockCoords coords;
+        coords.x = offset[0] / int(std::get<0>(blocksize));
+        coords.y = offset[1] / int(std::get<1>(blocksize));
+        coords.z = offset[2] / int(std::get<2>(blocksize));
+        if (foundblocks.insert(coords).second) {
+            GridPoint point = {{coords.x, coords.y, coords.z}};
+            points.push_back(point);
+        }
+    }
+
+    split_box(points, request_cost, boxes);
+    return boxes;
+}
@@ -2,18 +2,53 @@
 #define BLOCKFETCH_H
 
 #include <memory>
+#include <functional>
+#include <tuple>
+#include <vector>
+#include <cstdint>
 #include <libdvid/DVIDBlocks.h>
+#include "Block.h"
 
 // ?! base class for fetching blocks (derived types: libdvid blocks and moc server)
 // ?! create once and keep fetching -- reuse dvid node
 
 namespace lowtis {
 
+class BufferPool;
+
+/*!
+ * Box of blocks in block coordinates (minpt inclusive, maxpt exclusive).
+*/
+struct BlockBox {
+    int minpt[3];
+    int maxpt[3];
+
+    size_t volume() const
+    {
+        return size_t(maxpt[0]-minpt[0]) * (maxpt[1]-minpt[1]) * (maxpt[2]-minpt[2]);
+    }
+};
+
+/*!
+ * Checks for the SOI marker that starts jpeg data.
+ * \param data block data (can be null)
+ * \return true if the data starts like a jpeg image
+*/
+bool is_jpeg_data(const libdvid::BinaryDataPtr& data);
+
+/*!
+ * Receives blocks from a streaming fetch.  Calls are never concurrent
+ * but can come from fetcher threads.
+*/
+typedef std::function<void (const libdvid::DVIDCompressedBlock&)> BlockConsumer;
+
 // Not thread safe!
 // TODO: use more generic 'block' type for slices and cubes
 // always assume a rectangular cuboid.
 class BlockFetch {
   public:
+    virtual ~BlockFetch() {}
+
     /*!
      * Base class virtual function for retrieving blocks specified.
      * \param blocks loads compressed block data into provided coordinates 
@@ -21,6 +56,26 @@ class BlockFetch {
     virtual void extract_specific_blocks(
             std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom) = 0;
 
+    /*!
+     * Retrieves the blocks specified and hands each one to the consumer
+     * as soon as its response is parsed.  Every requested block is
+     * delivered exactly once (blocks without data are delivered last).
+     * The default implementation delivers after extract_specific_blocks.
+     * \param blocks blocks to retrieve
+     * \param zoom power of two zoom level
+     * \param consumer called for each retrieved block
+    */
+    virtual void stream_specific_blocks(
+            const std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer)
+    {
+        std::vector<libdvid::DVIDCompressedBlock> fetched = blocks;
+        extract_specific_blocks(fetched, zoom);
+        for (auto iter = fetched.begin(); iter != fetched.end(); ++iter) {
+            consumer(*iter);
+        }
+    }
+
     /*!
      * Base class to do non-blocking prefetch on specified blocks.
      * If a BlockFetch derived object does not support prefetching it will
@@ -32,21 +87,159 @@ class BlockFetch {
     }
 
     /*!
-     * Finds intersecting blocks.
-     * TODO: supports only isotropic blocks now.  If dimsteps are empty
+     * Checks whether the back-end stores data at the given zoom level.
+     * Missing levels can be built from finer levels by the caller
+     * (see LowtisConfig::synthesize_zoom_levels).
+     * \param zoom power of two zoom level
+     * \return true if blocks can be fetched at this zoom level
+    */
+    virtual bool has_zoom(int zoom)
+    {
+        return true;
+    }
+
+    /*!
+     * Reads the current version of the data (e.g., the DVID mutation
+     * id).  Every change to the voxels must change the version.
+     * \param version set to the current version
+     * \return false if the back-end does not report versions (cached
+     *   blocks then expire after LowtisConfig::refresh_rate)
+    */
+    virtual bool data_version(uint64_t& version)
+    {
+        return false;
+    }
+
+    /*!
+     * Tells whether block_changed can tell which blocks changed.  If not,
+     * blocks cached before a version change expire after
+     * LowtisConfig::refresh_rate instead of being dropped.
+     * \return true if block_changed is specific to each block
+    */
+    virtual bool reports_changed_blocks()
+    {
+        return false;
+    }
+
+    /*!
+     * Checks whether a block could have changed between two versions.
+     * Back-ends that cannot tell which blocks changed report every block.
+     * \param coords coordinates of block (with zoom level)
+     * \param version version the block was fetched at (or later)
+     * \param newversion current version
+     * \return true if the block must be fetched again
+    */
+    virtual bool block_changed(const BlockCoords& coords, uint64_t version, uint64_t newversion)
+    {
+        return true;
+    }
+
+    /*!
+     * Finds intersecting blocks.  Blocks can have a different size
+     * along each axis (see get_blocksize).  If dimsteps are empty
      * they are ignored.
      * \param dims size of subvolume requestsed
      * \param offset offset of subvolume
-     * \param zoom level for downsampled image
      * \param dim1step provides vector for a unit step in dim1
      * \param dim1step provides vector for a unit step in dim2
      * \param dim1step provides vector for a unit step in dim3
-     * \return list of compressed blocks
+     * \param zoom level for downsampled image
+     * \return list of blocks (without data)
+    */
+    std::vector<Block> intersecting_blocks(
+            std::vector<unsigned int> dims, std::vector<int> offset, std::vector<double> dim1step, std::vector<double> dim2step, std::vector<double> dim3step,
+            int zoom);
+
+    /*!
+     * Loads block data with extract_specific_blocks.
+     * \param blocks blocks to load (replaced by the fetched blocks)
+     * \param zoom power of two zoom level
+    */
+    void fetch_blocks(std::vector<Block>& blocks, int zoom);
+
+    /*!
+     * Retrieves blocks with stream_specific_blocks.
+     * \param blocks blocks to retrieve
+     * \param zoom power of two zoom level
+     * \param handler called for each retrieved block
+    */
+    void stream_blocks(const std::vector<Block>& blocks, int zoom, BlockHandler handler);
+
+    /*!
+     * Prefetches blocks with prefetch_blocks.
+     * \param blocks blocks to prefetch
+     * \param zoom power of two zoom level
+    */
+    void prefetch(const std::vector<Block>& blocks, int zoom);
+
+    /*!
+     * Wraps a block returned by extract_specific_blocks or
+     * stream_specific_blocks.  libdvid blocks do not expose their
+     * compression, so blocks holding every voxel (or one voxel for
+     * uniform blocks) are taken as uncompressed and others as
+     * compressed by the fetcher.  jpeg fetchers can also return blocks
+     * they re-encoded as lz4, which are told apart by the jpeg marker.
+     * \param block fetched block
+     * \param zoom zoom level of the block
+     * \return handle to the block data
+    */
+    Block wrap_block(const libdvid::DVIDCompressedBlock& block, int zoom) const;
+
+    //! bytes per voxel of the blocks
+    size_t get_bytedepth() const
+    {
+        return bytedepth;
+    }
+
+    //! block dimensions (x, y, z); libdvid blocks only hold the x size
+    std::tuple<size_t, size_t, size_t> get_blocksize() const
+    {
+        return blocksize;
+    }
+
+    //! true if blocks have the same size along each axis
+    bool cubic_blocks() const
+    {
+        return (std::get<0>(blocksize) == std::get<1>(blocksize)) &&
+            (std::get<1>(blocksize) == std::get<2>(blocksize));
+    }
+
+    //! number of voxels in a block
+    size_t block_voxels() const
+    {
+        return std::get<0>(blocksize) * std::get<1>(blocksize) * std::get<2>(blocksize);
+    }
+
+    /*!
+     * Decodes the voxels of a block fetched (or built) for this fetcher.
+     * libdvid sizes decoded lz4 data as a cube, so blocks that are not
+     * cubes are decoded here.  Uncompressed blocks are returned as is.
+     * lz4 blocks are decoded into a buffer from the pool (if given).
+     * \param block block with data
+     * \param pool recycled buffers for decoded data (optional)
+     * \return decoded voxels (ordered x, y, z)
     */
-    std::vector<libdvid::DVIDCompressedBlock> intersecting_blocks(
-            std::vector<unsigned int> dims, std::vector<int> offset, std::vector<double> dim1step, std::vector<double> dim2step, std::vector<double> dim3step);
+    libdvid::BinaryDataPtr uncompressed_data(const Block& block,
+            BufferPool* pool = 0) const;
+
+    //! compression of fetched blocks
+    libdvid::DVIDCompressedBlock::CompressType get_compression_type() const
+    {
+        return compression_type;
+    }
 
   protected:
+    /*!
+     * Covers a set of blocks with a few dense boxes.  A box is split
+     * while one more request costs less than the empty blocks
+     * that the split avoids fetching.
+     * \param blocks blocks to cover (block aligned)
+     * \param request_cost cost of one request measured in blocks
+     * \return boxes covering all blocks (in block coordinates)
+    */
+    std::vector<BlockBox> decompose_blocks(
+            const std::vector<libdvid::DVIDCompressedBlock>& blocks, double request_cost);
+
     size_t bytedepth;
     std::tuple<size_t, size_t, size_t> blocksize;
     libdvid::DVIDCompressedBlock::CompressType compression_type;
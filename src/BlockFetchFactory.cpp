@@ -1,19 +1,72 @@
 #include "BlockFetchFactory.h"
 #include "DVIDBlockFetch.h"
+#include "DVIDTileFetch.h"
 #include "GoogleBlockFetch.h"
+#include "LocalBlockFetch.h"
+#include "SyntheticBlockFetch.h"
+#include "HedgedBlockFetch.h"
+#include <functional>
 
 using namespace lowtis;
 
-BlockFetchPtr lowtis::create_blockfetcher(LowtisConfig* config)
+namespace {
+
+// makes back-end fetchers from a copy of the configuration
+std::function<BlockFetchPtr()> backend_maker(LowtisConfig* config)
 {
-    // create dvid block
     if (auto configcast = dynamic_cast<DVIDLabelblkConfig*>(config)) {
-        return BlockFetchPtr(new DVIDBlockFetch(*(configcast)));
+        DVIDLabelblkConfig copy = *configcast;
+        return [copy]() mutable { return BlockFetchPtr(new DVIDBlockFetch(copy)); };
     } else if (auto configcast = dynamic_cast<DVIDGrayblkConfig*>(config)) {
-        return BlockFetchPtr(new DVIDBlockFetch(*(configcast)));
+        DVIDGrayblkConfig copy = *configcast;
+        return [copy]() mutable { return BlockFetchPtr(new DVIDBlockFetch(copy)); };
     } else if (auto configcast = dynamic_cast<GoogleGrayblkConfig*>(config)) {
-        return BlockFetchPtr(new GoogleBlockFetch(*(configcast)));
+        GoogleGrayblkConfig copy = *configcast;
+        return [copy]() mutable { return BlockFetchPtr(new GoogleBlockFetch(copy)); };
+    } else if (auto configcast = dynamic_cast<LocalVolumeConfig*>(config)) {
+        LocalVolumeConfig copy = *configcast;
+        return [copy]() mutable { return BlockFetchPtr(new LocalBlockFetch(copy)); };
+    } else if (auto configcast = dynamic_cast<SyntheticConfig*>(config)) {
+        // each simulated connection gets its own random sequence
+        SyntheticConfig copy = *configcast;
+        return [copy]() mutable {
+            BlockFetchPtr fetcher(new SyntheticBlockFetch(copy));
+            ++copy.seed;
+            return fetcher;
+        };
+    }
+
+    return std::function<BlockFetchPtr()>();
+}
+
+// adds hedged requests and retries if configured
+BlockFetchPtr wrap_fetcher(LowtisConfig* config, std::function<BlockFetchPtr()> create_fetcher)
+{
+    if (!create_fetcher) {
+        return BlockFetchPtr(0);
     }
+    if ((config->hedge_percentile <= 0) && (config->max_retries == 0)) {
+        return create_fetcher();
+    }
+    return BlockFetchPtr(new HedgedBlockFetch(*config, create_fetcher));
+}
 
-    return BlockFetchPtr(0);
+}
+
+BlockFetchPtr lowtis::create_blockfetcher(LowtisConfig* config)
+{
+    // create dvid block
+    return wrap_fetcher(config, backend_maker(config));
+}
+
+BlockFetchPtr lowtis::create_tilefetcher(LowtisConfig* config)
+{
+    // (brainmaps does not serve tiles)
+    auto configcast = dynamic_cast<DVIDConfig*>(config);
+    if (!configcast || configcast->tile_instance.empty() ||
+            dynamic_cast<GoogleGrayblkConfig*>(config)) {
+        return BlockFetchPtr(0);
+    }
+    DVIDConfig copy = *configcast;
+    return wrap_fetcher(config, [copy]() mutable { return BlockFetchPtr(new DVIDTileFetch(copy)); });
 }
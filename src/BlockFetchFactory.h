@@ -9,4 +9,11 @@ namespace lowtis {
 
 BlockFetchPtr create_blockfetcher(LowtisConfig* config);
 
+/*!
+ * Creates a fetcher for 2D xy tiles if the configuration names a
+ * tile instance.
+ * \return tile fetcher or null if tiles are not configured
+*/
+BlockFetchPtr create_tilefetcher(LowtisConfig* config);
+
 }
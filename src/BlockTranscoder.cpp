@@ -0,0 +1,88 @@
+#include "BlockTranscoder.h"
+
+using namespace lowtis;
+using namespace libdvid;
+
+BlockTranscoder::BlockTranscoder(std::shared_ptr<BlockCache> cache_) : cache(cache_)
+{
+    thread = boost::thread(&BlockTranscoder::run, this);
+}
+
+BlockTranscoder::~BlockTranscoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+void BlockTranscoder::add_block(const Block& block)
+{
+    if (!block.get_data() || is_uniform_block(block)) {
+        return;
+    }
+
+    // decoded blocks are already fast
+    if (block.get_compression() == DVIDCompressedBlock::uncompressed) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((queue.size() >= MAXQUEUE) || !queued.insert(block.get_coords()).second) {
+        return;
+    }
+    queue.push_back(block.clone());
+    condition.notify_one();
+}
+
+void BlockTranscoder::pause()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++active;
+}
+
+void BlockTranscoder::resume()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --active;
+    }
+    condition.notify_one();
+}
+
+void BlockTranscoder::run()
+{
+    while (true) {
+        Block block;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return done || (!active && !queue.empty()); });
+            if (done) {
+                return;
+            }
+            block = std::move(queue.front());
+            queue.pop_front();
+            queued.erase(block.get_coords());
+        }
+
+        try {
+            // only cubic blocks are queued, which libdvid can decode
+            BinaryDataPtr data = block.to_dvid().get_uncompressed_data();
+            size_t typesize = block.get_typesize();
+
+            Block fast_block;
+            if (is_uniform_data(data->get_raw(), data->length(), typesize)) {
+                fast_block = make_uniform_block(data->get_raw(), block.get_coords(),
+                        block.get_blocksize(), typesize);
+            } else {
+                fast_block = Block(block.get_coords(), block.get_blocksize(), typesize,
+                        DVIDCompressedBlock::lz4, BinaryData::compress_lz4(data));
+            }
+            cache->replace_block(block.get_coords(), block, std::move(fast_block));
+        } catch (...) {
+            // leave blocks that cannot be decoded as they are
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef BLOCKTRANSCODER_H
+#define BLOCKTRANSCODER_H
+
+#include "BlockCache.h"
+#include <boost/thread/thread.hpp>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_set>
+
+namespace lowtis {
+
+/*!
+ * Re-encodes cached blocks into a format that decodes quickly.
+ * Blocks compressed with a slow codec (gzip_labelarray, jpeg) are
+ * replaced in the block cache by lz4 blocks, or by a single value
+ * if every voxel is the same (see make_uniform_block).  The work is
+ * done on a background thread only while no request is running.
+*/
+class BlockTranscoder {
+  public:
+    //! max blocks waiting to be transcoded (others are dropped)
+    static const size_t MAXQUEUE = 1024;
+
+    /*!
+     * Starts the background thread.
+     * \param cache_ cache whose blocks are replaced
+    */
+    BlockTranscoder(std::shared_ptr<BlockCache> cache_);
+
+    /*!
+     * Stops the background thread (queued blocks are dropped).
+    */
+    ~BlockTranscoder();
+
+    /*!
+     * Queues a cached block for transcoding.  Blocks that are
+     * already uncompressed or uniform are ignored.
+     * \param block block as retrieved from the cache
+    */
+    void add_block(const Block& block);
+
+    /*!
+     * Holds off transcoding while a request runs.  Calls can be nested.
+    */
+    void pause();
+
+    /*!
+     * Allows transcoding once every pause has been resumed.
+    */
+    void resume();
+
+  private:
+    void run();
+
+    std::shared_ptr<BlockCache> cache;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Block> queue;
+
+    //! queued block coordinates (avoids transcoding twice)
+    std::unordered_set<BlockCoords> queued;
+
+    //! number of requests running
+    int active = 0;
+    bool done = false;
+
+    boost::thread thread;
+};
+
+}
+
+#endif
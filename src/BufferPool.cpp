@@ -0,0 +1,114 @@
+#include "BufferPool.h"
+#include <sys/mman.h>
+#include <cstdint>
+#include <cstring>
+
+using namespace lowtis;
+using namespace libdvid;
+
+namespace {
+
+// smallest power of two >= length
+size_t ceil_class(size_t length)
+{
+    size_t sizeclass = 1;
+    while (sizeclass < length) {
+        sizeclass <<= 1;
+    }
+    return sizeclass;
+}
+
+// largest power of two <= capacity
+size_t floor_class(size_t capacity)
+{
+    size_t sizeclass = 1;
+    while ((sizeclass << 1) <= capacity) {
+        sizeclass <<= 1;
+    }
+    return sizeclass;
+}
+
+// transparent huge pages can only back whole aligned pages
+void advise_hugepages(char* start, size_t length)
+{
+#ifdef MADV_HUGEPAGE
+    const uintptr_t HUGEPAGE = 2 << 20;
+    uintptr_t first = (reinterpret_cast<uintptr_t>(start) + HUGEPAGE - 1) & ~(HUGEPAGE - 1);
+    uintptr_t last = (reinterpret_cast<uintptr_t>(start) + length) & ~(HUGEPAGE - 1);
+    if (last > first) {
+        madvise(reinterpret_cast<void*>(first), last - first, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+}
+
+BinaryDataPtr BufferPool::acquire(size_t length, bool zero)
+{
+    BinaryDataPtr data;
+    if (length >= MINBUFFER) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto iter = free_buffers.find(ceil_class(length));
+        if ((iter != free_buffers.end()) && !iter->second.empty()) {
+            data = iter->second.back();
+            iter->second.pop_back();
+            pooled_bytes -= data->get_data().capacity();
+            ++reused;
+        } else {
+            ++allocated;
+        }
+    }
+
+    if (!data) {
+        // allocate the whole class so the buffer can be reused for its class
+        data = BinaryData::create_binary_data();
+        if (length >= MINBUFFER) {
+            size_t capacity = ceil_class(length);
+            data->get_data().reserve(capacity);
+            if (hugepages) {
+                advise_hugepages(&(data->get_data()[0]), capacity);
+            }
+        }
+    }
+
+    // no reallocation within the capacity
+    std::string& raw = data->get_data();
+    if (zero) {
+        raw.assign(length, '\0');
+    } else {
+        raw.resize(length);
+    }
+    return data;
+}
+
+void BufferPool::release(BinaryDataPtr& data)
+{
+    // nothing else can be using the buffer
+    if (!data || (data.use_count() > 1)) {
+        return;
+    }
+    size_t capacity = data->get_data().capacity();
+    if (capacity < MINBUFFER) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((pooled_bytes + capacity)/1000000 > max_size) {
+        return;
+    }
+    pooled_bytes += capacity;
+    free_buffers[floor_class(capacity)].push_back(data);
+    data.reset();
+}
+
+size_t BufferPool::num_allocated()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocated;
+}
+
+size_t BufferPool::num_reused()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return reused;
+}
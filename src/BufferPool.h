@@ -0,0 +1,74 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <libdvid/BinaryData.h>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+namespace lowtis {
+
+/*!
+ * Recycles large buffers of decoded block data so that steady
+ * panning reuses memory instead of allocating and freeing a block
+ * sized buffer for every decode.  Buffers are kept in power of two
+ * size classes (a class holds buffers with at least that capacity).
+ * Only buffers that nothing else references are taken back.  Each
+ * function is thread-safe.
+*/
+class BufferPool {
+  public:
+    //! smaller buffers are left to the allocator
+    static const size_t MINBUFFER = 4096;
+
+    /*!
+     * Creates an empty pool.
+     * \param max_size_ limit of the memory kept for reuse (in MBs)
+     * \param hugepages_ ask for huge pages when allocating large buffers
+    */
+    BufferPool(size_t max_size_, bool hugepages_ = false) :
+        max_size(max_size_), hugepages(hugepages_) {}
+
+    /*!
+     * Gets a buffer from the pool (allocated if none is free).
+     * \param length size of the buffer in bytes
+     * \param zero set all bytes to zero (otherwise the contents are undefined)
+     * \return buffer of exactly length bytes
+    */
+    libdvid::BinaryDataPtr acquire(size_t length, bool zero = true);
+
+    /*!
+     * Returns a buffer to the pool.  Buffers that are still shared,
+     * too small or beyond the size limit are left alone.
+     * \param data buffer to recycle (reset when taken)
+    */
+    void release(libdvid::BinaryDataPtr& data);
+
+    //! number of buffers allocated by acquire
+    size_t num_allocated();
+
+    //! number of acquire calls served by recycled buffers
+    size_t num_reused();
+
+  private:
+    //! free buffers by size class
+    std::unordered_map<size_t, std::vector<libdvid::BinaryDataPtr> > free_buffers;
+
+    //! capacity of the free buffers (in bytes)
+    unsigned long long pooled_bytes = 0;
+
+    //! max size of free buffers in MBs
+    size_t max_size;
+
+    //! advise huge pages for new buffers
+    bool hugepages;
+
+    size_t allocated = 0;
+    size_t reused = 0;
+
+    std::mutex mutex;
+};
+
+}
+
+#endif
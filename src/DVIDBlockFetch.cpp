@@ -3,7 +3,15 @@
 #include <unordered_map>
 #include "BlockCache.h"
 #include <lowtis/lowtis.h>
+#include <libdvid/DVIDException.h>
+#include <json/json.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/thread.hpp>
+#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
 
 using namespace lowtis; using namespace libdvid;
 using std::string; using std::vector; using std::unordered_map;
@@ -11,8 +19,14 @@ using std::string; using std::vector; using std::unordered_map;
 DVIDBlockFetch::DVIDBlockFetch(DVIDConfig& config) :
         labeltypename(config.datatypename), usehighiopquery(config.usehighiopquery),
         node_service(config.dvid_server, config.dvid_uuid, config.username, "lowtis"),
-	supervoxelview(config.supervoxelview)
+	supervoxelview(config.supervoxelview), subvolume_request_cost(config.subvolume_request_cost),
+        request_chunk_size(config.request_chunk_size)
 {
+    // copies share the server settings without reconnecting
+    for (unsigned int i = 0; i < std::max(config.num_connections, 1u); ++i) {
+        connections.push_back(node_service);
+    }
+
     size_t isoblksize = node_service.get_blocksize(labeltypename); 
     blocksize = std::make_tuple(isoblksize, isoblksize, isoblksize);
     bytedepth = config.bytedepth;
@@ -71,7 +85,79 @@ void DVIDBlockFetch::prefetch_blocks(vector<libdvid::DVIDCompressedBlock>& block
         node_service.prefetch_specificblocks3D(dataname_temp, blockcoords);   
 }
 
-vector<libdvid::DVIDCompressedBlock> DVIDBlockFetch::extract_blocks(
+namespace {
+
+// interleave the bits of non-negative block coordinates
+uint64_t morton_code(int x, int y, int z)
+{
+    uint64_t code = 0;
+    for (int bit = 0; bit < 21; ++bit) {
+        code |= (uint64_t((x >> bit) & 1) << (3*bit)) |
+            (uint64_t((y >> bit) & 1) << (3*bit + 1)) |
+            (uint64_t((z >> bit) & 1) << (3*bit + 2));
+    }
+    return code;
+}
+
+}
+
+bool DVIDBlockFetch::has_zoom(int zoom)
+{
+    if (zoom == 0) {
+        return true;
+    }
+    if ((dvidtype == "labelarray") || (dvidtype == "labelmap")) {
+        return zoom <= maxlevel;
+    }
+
+    auto iter = zoomlevels.find(zoom);
+    if (iter != zoomlevels.end()) {
+        return iter->second;
+    }
+
+    // check whether the downsampled instance exists (only a client
+    // error says it is missing; other failures are not remembered)
+    bool found = true;
+    try {
+        node_service.get_typeinfo(labeltypename + "_" + std::to_string(zoom));
+    } catch (DVIDException& err) {
+        if ((err.get_status() < 400) || (err.get_status() >= 500)) {
+            throw;
+        }
+        found = false;
+    }
+    zoomlevels[zoom] = found;
+    return found;
+}
+
+bool DVIDBlockFetch::data_version(uint64_t& version)
+{
+    if (dvidtype != "labelmap") {
+        return false;
+    }
+
+    BinaryDataPtr lastmod;
+    try {
+        lastmod = node_service.custom_request(labeltypename + "/lastmod", BinaryDataPtr(), GET);
+    } catch (DVIDException& err) {
+        // older servers do not have the endpoint
+        if ((err.get_status() == 400) || (err.get_status() == 404)) {
+            return false;
+        }
+        throw;
+    }
+
+    Json::Value data;
+    Json::Reader json_reader;
+    if (!json_reader.parse(lastmod->get_data(), data) || !data.isObject() ||
+            !data.isMember("mutation id")) {
+        return false;
+    }
+    version = data["mutation id"].asUInt64();
+    return true;
+}
+
+vector<libdvid::DVIDCompressedBlock> DVIDBlockFetch::extract_blocks(DVIDNodeService& service,
         vector<unsigned int> dims, vector<int> offset, int zoom)
 {
     if ((dvidtype == "labelarray") || (dvidtype == "labelmap")) {
@@ -121,127 +207,242 @@ vector<libdvid::DVIDCompressedBlock> DVIDBlockFetch::extract_blocks(
     // use grayscale interface for single byte
     // TODO: eventually replace with single libdvid call
     if (bytedepth == 1) {
-        vector<libdvid::DVIDCompressedBlock> blocks = node_service.get_grayblocks3D(dataname_temp,
+        vector<libdvid::DVIDCompressedBlock> blocks = service.get_grayblocks3D(dataname_temp,
                 bdims, offset, false);
         return blocks;
     } else {
-        vector<libdvid::DVIDCompressedBlock> blocks = node_service.get_labelblocks3D(dataname_temp,
+        vector<libdvid::DVIDCompressedBlock> blocks = service.get_labelblocks3D(dataname_temp,
                 bdims, offset, false);
         return blocks;
     }
 }
 
-// the zoom level is needed to interact with cache and set proper data source
-void DVIDBlockFetch::extract_specific_blocks(
-            vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+void DVIDBlockFetch::extract_subvolumes(const vector<libdvid::DVIDCompressedBlock>& blocks,
+        int zoom, ResultHandler handler)
 {
-    if (blocks.empty()) {
-        return;
+    // split the bounding box of the request into dense boxes
+    vector<BlockBox> boxes = decompose_blocks(blocks, subvolume_request_cost);
+    size_t isoblksize = std::get<0>(blocksize);
+
+    run_on_connections(boxes.size(), [&](size_t id, DVIDNodeService& service) {
+        vector<int> goffset(3);
+        vector<unsigned int> dims(3);
+        for (int i = 0; i < 3; ++i) {
+            goffset[i] = boxes[id].minpt[i] * int(isoblksize);
+            dims[i] = (boxes[id].maxpt[i] - boxes[id].minpt[i]) * isoblksize;
+        }
+        vector<DVIDCompressedBlock> newblocks = extract_blocks(service, dims, goffset, zoom);
+        handler(newblocks);
+    });
+}
+
+void DVIDBlockFetch::extract_chunked_blocks(const vector<libdvid::DVIDCompressedBlock>& blocks,
+        int zoom, ResultHandler handler)
+{
+    string dataname_temp = labeltypename;
+    if ((zoom > 0) && (dvidtype != "labelarray") && (dvidtype != "labelmap")) {
+        // do not use if explicit zoom levels supported
+        dataname_temp += "_" + std::to_string(zoom);
     }
-    vector<DVIDCompressedBlock> newblocks; 
 
-    // only grayscale fetch works with specific block interface
-    if (!usehighiopquery || (!usespecificblocks)) {
-        // perform if labelblk datatype (>1 byte and lz4 compression)
-        // find bounding box for request 
-        int minx = INT_MAX; int miny = INT_MAX; int minz = INT_MAX;
-        int maxx = INT_MIN; int maxy = INT_MIN; int maxz = INT_MIN;
+    // check against max scale level (easy to do for labelarray)
+    if ((zoom > maxlevel) && ((dvidtype == "labelarray") || (dvidtype == "labelmap"))) {
+        throw LowtisErr("Trying to request unknown scale level");
+    }
 
-        for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
-            vector<int> offset = iter->get_offset();
-            size_t blocksize = iter->get_blocksize();
-            if (offset[0] < minx) {
-                minx = offset[0];
-            }
-            if (offset[1] < miny) {
-                miny = offset[1];
-            }
-            if (offset[2] < minz) {
-                minz = offset[2];
-            }
-            if (int(offset[0]+blocksize) > maxx) {
-                maxx = offset[0]+blocksize;
-            }
-            if (int(offset[1]+blocksize) > maxy) {
-                maxy = offset[1]+blocksize;
-            }
-            if (int(offset[2]+blocksize) > maxz) {
-                maxz = offset[2]+blocksize;
-            }
-        }
-        vector<int> goffset;
-        goffset.push_back(minx);
-        goffset.push_back(miny);
-        goffset.push_back(minz);
-
-        vector<unsigned int> dims;
-        dims.push_back(maxx-minx);
-        dims.push_back(maxy-miny);
-        dims.push_back(maxz-minz);
-
-        // call main query function
-        // TODO: allow parallel requests to decompose an inefficiently packed bbox
-        newblocks = extract_blocks(dims, goffset, zoom); 
-    } else {
+    // order blocks along a z-order curve so chunks are compact
+    vector<BlockCoords> coords;
+    int minpt[3] = {INT_MAX, INT_MAX, INT_MAX};
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        vector<int> offset = iter->get_offset();
+        int blocksize = iter->get_blocksize();
+        BlockCoords coord;
+        coord.x = offset[0]/blocksize;
+        coord.y = offset[1]/blocksize;
+        coord.z = offset[2]/blocksize;
+        minpt[0] = std::min(minpt[0], coord.x);
+        minpt[1] = std::min(minpt[1], coord.y);
+        minpt[2] = std::min(minpt[2], coord.z);
+        coords.push_back(coord);
+    }
+    std::sort(coords.begin(), coords.end(), [&minpt](const BlockCoords& c1, const BlockCoords& c2) {
+        return morton_code(c1.x-minpt[0], c1.y-minpt[1], c1.z-minpt[2]) <
+            morton_code(c2.x-minpt[0], c2.y-minpt[1], c2.z-minpt[2]);
+    });
+
+    // split into chunks and request the chunks closest to the center first
+    size_t chunksize = request_chunk_size ? request_chunk_size : coords.size();
+    vector<vector<int> > chunks;
+    vector<double> chunkdist;
+    double center[3] = {0, 0, 0};
+    for (auto iter = coords.begin(); iter != coords.end(); ++iter) {
+        center[0] += iter->x;
+        center[1] += iter->y;
+        center[2] += iter->z;
+    }
+    for (int i = 0; i < 3; ++i) {
+        center[i] /= coords.size();
+    }
+    for (size_t start = 0; start < coords.size(); start += chunksize) {
+        size_t finish = std::min(start + chunksize, coords.size());
         vector<int> blockcoords;
-        for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
-            vector<int> offset = iter->get_offset();
-            size_t blocksize = iter->get_blocksize();
-            blockcoords.push_back(offset[0]/blocksize);
-            blockcoords.push_back(offset[1]/blocksize);
-            blockcoords.push_back(offset[2]/blocksize);
-        }
-        string dataname_temp = labeltypename;
-        if ((zoom > 0) && (dvidtype != "labelarray") && (dvidtype != "labelmap")) {
-            // do not use if explicit zoom levels supported
-            dataname_temp += "_" + std::to_string(zoom);
+        double chunkcenter[3] = {0, 0, 0};
+        for (size_t pos = start; pos < finish; ++pos) {
+            blockcoords.push_back(coords[pos].x);
+            blockcoords.push_back(coords[pos].y);
+            blockcoords.push_back(coords[pos].z);
+            chunkcenter[0] += coords[pos].x;
+            chunkcenter[1] += coords[pos].y;
+            chunkcenter[2] += coords[pos].z;
         }
-        
-        // check against max scale level (easy to do for labelarray)
-        if ((zoom > maxlevel) && ((dvidtype == "labelarray") || (dvidtype == "labelmap"))) {
-            throw LowtisErr("Trying to request unknown scale level");
+        double dist = 0;
+        for (int i = 0; i < 3; ++i) {
+            double diff = chunkcenter[i]/(finish-start) - center[i];
+            dist += diff*diff;
         }
+        chunks.push_back(blockcoords);
+        chunkdist.push_back(dist);
+    }
+    vector<size_t> order(chunks.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&chunkdist](size_t c1, size_t c2) {
+        return chunkdist[c1] < chunkdist[c2];
+    });
 
+    run_on_connections(chunks.size(), [&](size_t id, DVIDNodeService& service) {
+        const vector<int>& blockcoords = chunks[order[id]];
+        vector<DVIDCompressedBlock> newblocks;
         if ((dvidtype == "labelarray") || (dvidtype == "labelmap")) {
             // set scale for labelarray and labelmap
-            node_service.get_specificblocks3D(dataname_temp, blockcoords, true, newblocks, zoom, false, supervoxelview);
+            service.get_specificblocks3D(dataname_temp, blockcoords, true, newblocks, zoom, false, supervoxelview);
+        } else if (compression_type == DVIDCompressedBlock::uncompressed) {
+            service.get_specificblocks3D(dataname_temp, blockcoords, true, newblocks, 0, true);
         } else {
-            if (compression_type == DVIDCompressedBlock::uncompressed) {
-                //std::cout << "blah0" << std::endl;
-                node_service.get_specificblocks3D(dataname_temp, blockcoords, true, newblocks, 0, true);
-                //std::cout << "blah1" << std::endl;
-            } else {
-                node_service.get_specificblocks3D(dataname_temp, blockcoords, true, newblocks);
+            service.get_specificblocks3D(dataname_temp, blockcoords, true, newblocks);
+        }
+        handler(newblocks);
+    });
+}
+
+void DVIDBlockFetch::run_on_connections(size_t numtasks,
+        std::function<void (size_t, DVIDNodeService&)> task)
+{
+    if (numtasks == 0) {
+        return;
+    }
+
+    vector<std::exception_ptr> errors(numtasks);
+    std::atomic<size_t> nexttask(0);
+
+    // each worker owns a connection and takes the next task in order
+    auto worker = [&](size_t connid) {
+        for (size_t id = nexttask++; id < numtasks; id = nexttask++) {
+            try {
+                task(id, connections[connid]);
+            } catch (...) {
+                errors[id] = std::current_exception();
             }
         }
+    };
+
+    size_t numworkers = std::min(numtasks, connections.size());
+    if (numworkers == 1) {
+        worker(0);
+    } else {
+        boost::thread_group threads; // destructor auto deletes threads
+        for (size_t connid = 0; connid < numworkers; ++connid) {
+            threads.add_thread(new boost::thread(worker, connid));
+        }
+        threads.join_all();
     }
 
+    for (size_t id = 0; id < numtasks; ++id) {
+        if (errors[id]) {
+            std::rethrow_exception(errors[id]);
+        }
+    }
+}
+
+// the zoom level is needed to interact with cache and set proper data source
+void DVIDBlockFetch::extract_specific_blocks(
+            vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+{
     // find and set requested blocks
-    unordered_map<BlockCoords, BlockData> cache;
-    for (auto iter = newblocks.begin(); iter != newblocks.end(); ++iter) {
+    unordered_map<BlockCoords, size_t> blockindex;
+    for (size_t id = 0; id < blocks.size(); ++id) {
         BlockCoords coords;
-        vector<int> offset = iter->get_offset();
+        vector<int> offset = blocks[id].get_offset();
         coords.x = offset[0];
         coords.y = offset[1];
         coords.z = offset[2];
-        coords.zoom = zoom;
-        BlockData data;
-        data.block = *iter;
-        cache[coords] = data;
+        blockindex[coords] = id;
     }
-    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+
+    stream_specific_blocks(blocks, zoom, [&](const DVIDCompressedBlock& block) {
         BlockCoords coords;
-        vector<int> offset = iter->get_offset();
+        vector<int> offset = block.get_offset();
+        coords.x = offset[0];
+        coords.y = offset[1];
+        coords.z = offset[2];
+        blocks[blockindex[coords]] = block;
+    });
+}
+
+void DVIDBlockFetch::stream_specific_blocks(
+            const vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer)
+{
+    if (blocks.empty()) {
+        return;
+    }
+
+    // requested blocks by location
+    unordered_map<BlockCoords, size_t> blockindex;
+    for (size_t id = 0; id < blocks.size(); ++id) {
+        BlockCoords coords;
+        vector<int> offset = blocks[id].get_offset();
         coords.x = offset[0];
         coords.y = offset[1];
         coords.z = offset[2];
-        coords.zoom = zoom;
+        blockindex[coords] = id;
+    }
+    vector<bool> delivered(blocks.size(), false);
+
+    // deliver each requested block from a completed request
+    std::mutex deliver_mutex;
+    auto handler = [&](vector<DVIDCompressedBlock>& newblocks) {
+        std::lock_guard<std::mutex> lock(deliver_mutex);
+        for (auto iter = newblocks.begin(); iter != newblocks.end(); ++iter) {
+            BlockCoords coords;
+            vector<int> offset = iter->get_offset();
+            coords.x = offset[0];
+            coords.y = offset[1];
+            coords.z = offset[2];
 
-        auto dataiter = cache.find(coords);
-        if (dataiter != cache.end()) {
-            //throw LowtisErr("Failed to fetch block");
-            iter->set_data(dataiter->second.block.get_data());
+            auto dataiter = blockindex.find(coords);
+            if ((dataiter != blockindex.end()) && !delivered[dataiter->second]) {
+                delivered[dataiter->second] = true;
+                DVIDCompressedBlock block = blocks[dataiter->second];
+                block.set_data(iter->get_data());
+                consumer(block);
+            }
         }
+    };
+
+    // only grayscale fetch works with specific block interface
+    if (!usehighiopquery || (!usespecificblocks)) {
+        // perform if labelblk datatype (>1 byte and lz4 compression)
+        extract_subvolumes(blocks, zoom, handler);
+    } else {
+        extract_chunked_blocks(blocks, zoom, handler);
     }
-}
 
+    // blocks not returned have no data
+    for (size_t id = 0; id < blocks.size(); ++id) {
+        if (!delivered[id]) {
+            consumer(blocks[id]);
+        }
+    }
+}
@@ -4,6 +4,8 @@
 #include "BlockFetch.h"
 #include <lowtis/LowtisConfig.h>
 #include <libdvid/DVIDNodeService.h>
+#include <unordered_map>
+#include <functional>
 
 namespace lowtis {
 
@@ -30,18 +32,81 @@ class DVIDBlockFetch : public BlockFetch {
     void extract_specific_blocks(
             std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom);
 
+    /*!
+     * Retrieves the blocks specified and hands them to the consumer
+     * as each request (subvolume or chunk of blocks) completes.
+     * \param blocks blocks to retrieve
+     * \param consumer called for each retrieved block
+    */
+    void stream_specific_blocks(
+            const std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer);
+
+    /*!
+     * Checks whether the zoom level is available.  labelarray and
+     * labelmap store levels up to MaxDownresLevel; other types
+     * need a separate <instance>_<zoom> instance.
+     * \param zoom power of two zoom level
+     * \return true if blocks can be fetched at this zoom level
+    */
+    bool has_zoom(int zoom);
+
+    /*!
+     * Reads the mutation id of labelmap instances (<instance>/lastmod),
+     * which changes with every edit of the labels.
+     * \param version set to the mutation id
+     * \return false for other types or servers without the endpoint
+    */
+    bool data_version(uint64_t& version);
+
   private:
+    //! receives the blocks of one completed request
+    typedef std::function<void (std::vector<libdvid::DVIDCompressedBlock>&)> ResultHandler;
 
     /*!
      * Fetch 3D subvolume from DVID using labelblks.  The size and
      * offset will be adjusted to make the request block aligned.
+     * \param service connection used for the request
      * \param dims size of subvolume requestsed
      * \param offset offset of subvolume
      * \return list of compressed blocks
     */
-    std::vector<libdvid::DVIDCompressedBlock> extract_blocks(
+    std::vector<libdvid::DVIDCompressedBlock> extract_blocks(libdvid::DVIDNodeService& service,
             std::vector<unsigned int> dims, std::vector<int> offset, int zoom);
 
+    /*!
+     * Fetch the blocks as a few dense subvolumes (requested in parallel)
+     * instead of one sparse bounding box.
+     * \param blocks blocks to fetch
+     * \param handler called with the blocks of each subvolume
+    */
+    void extract_subvolumes(const std::vector<libdvid::DVIDCompressedBlock>& blocks,
+            int zoom, ResultHandler handler);
+
+    /*!
+     * Fetch the blocks with the specific block interface.  Large
+     * requests are split into spatially coherent chunks that are
+     * requested in parallel, starting with the chunks nearest
+     * the center of the request.
+     * \param blocks blocks to fetch
+     * \param handler called with the blocks of each chunk
+    */
+    void extract_chunked_blocks(const std::vector<libdvid::DVIDCompressedBlock>& blocks,
+            int zoom, ResultHandler handler);
+
+    /*!
+     * Runs tasks on the connection pool.  Tasks are started in order
+     * and each running task has its own connection.  The first error
+     * is rethrown after all tasks finish.
+     * \param numtasks number of tasks
+     * \param task function taking the task id and a connection
+    */
+    void run_on_connections(size_t numtasks,
+            std::function<void (size_t, libdvid::DVIDNodeService&)> task);
+
+
+    //! cached results for zoom level instance checks
+    std::unordered_map<int, bool> zoomlevels;
 
     int maxlevel = 0;
     bool usespecificblocks = false;
@@ -50,6 +115,11 @@ class DVIDBlockFetch : public BlockFetch {
     bool usehighiopquery;
     libdvid::DVIDNodeService node_service;
     bool supervoxelview;
+    double subvolume_request_cost;
+    unsigned int request_chunk_size;
+
+    //! connections for parallel requests
+    std::vector<libdvid::DVIDNodeService> connections;
 };
 
 }
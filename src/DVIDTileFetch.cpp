@@ -0,0 +1,133 @@
+#include "DVIDTileFetch.h"
+#include <lowtis/lowtis.h>
+#include <boost/thread/thread.hpp>
+#include <json/json.h>
+#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+using namespace lowtis; using namespace libdvid;
+using std::string; using std::vector;
+
+DVIDTileFetch::DVIDTileFetch(DVIDConfig& config) :
+        tile_instance(config.tile_instance),
+        node_service(config.dvid_server, config.dvid_uuid, config.username, "lowtis")
+{
+    // copies share the server settings without reconnecting
+    for (unsigned int i = 0; i < std::max(config.num_connections, 1u); ++i) {
+        connections.push_back(node_service);
+    }
+
+    bytedepth = config.bytedepth;
+    if (bytedepth != 1) {
+        throw LowtisErr("Tiles are only supported for grayscale data");
+    }
+    compression_type = DVIDCompressedBlock::jpeg;
+
+    // tile size and levels (every level has the same tile size)
+    auto metadata = node_service.custom_request(tile_instance + "/metadata", BinaryDataPtr(), GET);
+    Json::Value data;
+    Json::Reader json_reader;
+    if (!json_reader.parse(metadata->get_data(), data)) {
+        throw LowtisErr("Could not decode tile metadata for " + tile_instance);
+    }
+    Json::Value levels = data["Levels"];
+    Json::Value tilesize = levels["0"]["TileSize"];
+    if (!tilesize.isArray() || (tilesize.size() < 2)) {
+        throw LowtisErr("Tile metadata has no tile size for " + tile_instance);
+    }
+    num_levels = levels.size();
+    blocksize = std::make_tuple(size_t(tilesize[0].asUInt()), size_t(tilesize[1].asUInt()), size_t(1));
+}
+
+bool DVIDTileFetch::has_zoom(int zoom)
+{
+    return (zoom >= 0) && (zoom < num_levels);
+}
+
+void DVIDTileFetch::extract_specific_blocks(
+            vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+{
+    vector<DVIDCompressedBlock> fetched;
+    stream_specific_blocks(blocks, zoom, [&](const DVIDCompressedBlock& block) {
+        fetched.push_back(block);
+    });
+    blocks.swap(fetched);
+}
+
+void DVIDTileFetch::stream_specific_blocks(
+            const vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer)
+{
+    if (blocks.empty()) {
+        return;
+    }
+    if (!has_zoom(zoom)) {
+        throw LowtisErr("Trying to request unknown tile level");
+    }
+
+    int tx = std::get<0>(blocksize);
+    int ty = std::get<1>(blocksize);
+    vector<DVIDCompressedBlock> empty_blocks;
+    vector<std::exception_ptr> errors(blocks.size());
+    std::atomic<size_t> nexttile(0);
+    std::mutex mutex;
+
+    // each worker owns a connection and takes the next tile
+    auto worker = [&](size_t connid) {
+        for (size_t id = nexttile++; id < blocks.size(); id = nexttile++) {
+            DVIDCompressedBlock block = blocks[id];
+            vector<int> offset = block.get_offset();
+            vector<int> tile_loc;
+            tile_loc.push_back(offset[0] / tx);
+            tile_loc.push_back(offset[1] / ty);
+            tile_loc.push_back(offset[2]);
+
+            try {
+                BinaryDataPtr data = connections[connid].get_tile_slice_binary(tile_instance,
+                        XY, zoom, tile_loc);
+                const unsigned char* raw = data->get_raw();
+                if ((data->length() < 2) || (raw[0] != 0xFF) || (raw[1] != 0xD8)) {
+                    throw LowtisErr("Tiles must be jpeg encoded: " + tile_instance);
+                }
+                block.set_data(data);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                consumer(block);
+            } catch (DVIDException& err) {
+                // tiles outside the data are not stored
+                if (err.get_status() == 404) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    empty_blocks.push_back(block);
+                } else {
+                    errors[id] = std::current_exception();
+                }
+            } catch (...) {
+                errors[id] = std::current_exception();
+            }
+        }
+    };
+
+    size_t numworkers = std::min(blocks.size(), connections.size());
+    if (numworkers == 1) {
+        worker(0);
+    } else {
+        boost::thread_group threads; // destructor auto deletes threads
+        for (size_t connid = 0; connid < numworkers; ++connid) {
+            threads.add_thread(new boost::thread(worker, connid));
+        }
+        threads.join_all();
+    }
+
+    for (size_t id = 0; id < errors.size(); ++id) {
+        if (errors[id]) {
+            std::rethrow_exception(errors[id]);
+        }
+    }
+
+    // tiles without data are delivered last
+    for (auto iter = empty_blocks.begin(); iter != empty_blocks.end(); ++iter) {
+        consumer(*iter);
+    }
+}
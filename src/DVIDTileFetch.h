@@ -0,0 +1,65 @@
+#ifndef DVIDTILEFETCH_H
+#define DVIDTILEFETCH_H
+
+#include "BlockFetch.h"
+#include <lowtis/LowtisConfig.h>
+#include <libdvid/DVIDNodeService.h>
+#include <vector>
+#include <string>
+
+namespace lowtis {
+
+/*!
+ * Fetches 2D xy tiles from a DVID imagetile instance.  Each tile is
+ * treated as a block one voxel deep, so an xy view only downloads
+ * the plane it shows instead of whole 3D blocks.  Tiles at a zoom
+ * level are addressed in the voxel coordinates of that level (the
+ * z of a tile is its slice at that level).  Tiles must be jpeg
+ * encoded grayscale; missing tiles are empty.
+*/
+class DVIDTileFetch : public BlockFetch {
+  public:
+    /*!
+     * Reads the tile size and number of levels from the instance.
+     * \param config contains server, uuid, user and tile_instance
+    */
+    DVIDTileFetch(DVIDConfig& config);
+
+    /*!
+     * Base class virtual function for retrieving blocks specified.
+     * \param blocks tiles (blocks one voxel deep) to load data into
+    */
+    void extract_specific_blocks(
+            std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom);
+
+    /*!
+     * Retrieves the tiles in parallel (one request per tile) and hands
+     * each one to the consumer as it arrives.
+     * \param blocks tiles to retrieve
+     * \param consumer called for each retrieved tile
+    */
+    void stream_specific_blocks(
+            const std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer);
+
+    /*!
+     * Checks whether the instance has tiles at the zoom level.
+     * \param zoom power of two zoom level
+     * \return true if tiles can be fetched at this zoom level
+    */
+    bool has_zoom(int zoom);
+
+  private:
+    std::string tile_instance;
+    libdvid::DVIDNodeService node_service;
+
+    //! number of tile levels stored
+    int num_levels = 0;
+
+    //! connections for parallel requests
+    std::vector<libdvid::DVIDNodeService> connections;
+};
+
+}
+
+#endif
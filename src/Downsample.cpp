@@ -0,0 +1,126 @@
+#include "Downsample.h"
+#include <lowtis/lowtis.h>
+#include <cstring>
+#include <cstdint>
+
+using namespace lowtis;
+
+namespace {
+
+// mean of each 2x2x2 cube for one output row
+void mean_row(const unsigned char* r00, const unsigned char* r01,
+        const unsigned char* r10, const unsigned char* r11,
+        unsigned char* out, size_t outwidth)
+{
+    for (size_t x = 0; x < outwidth; ++x) {
+        unsigned int sum = r00[2*x] + r00[2*x+1] + r01[2*x] + r01[2*x+1] +
+            r10[2*x] + r10[2*x+1] + r11[2*x] + r11[2*x+1];
+        out[x] = static_cast<unsigned char>((sum + 4) >> 3);
+    }
+}
+
+// most frequent of 8 values (smaller value wins a tie)
+template <typename T>
+inline T mode8(const T* vals)
+{
+    bool same = true;
+    for (int i = 1; i < 8; ++i) {
+        same &= (vals[i] == vals[0]);
+    }
+    if (same) {
+        return vals[0];
+    }
+
+    T best = vals[0];
+    int bestcount = 0;
+    for (int i = 0; i < 8; ++i) {
+        int count = 0;
+        for (int j = 0; j < 8; ++j) {
+            count += (vals[j] == vals[i]);
+        }
+        if ((count > bestcount) || ((count == bestcount) && (vals[i] < best))) {
+            best = vals[i];
+            bestcount = count;
+        }
+    }
+    return best;
+}
+
+// mode of each 2x2x2 cube for one output row
+template <typename T>
+void mode_row(const unsigned char* r00, const unsigned char* r01,
+        const unsigned char* r10, const unsigned char* r11,
+        unsigned char* out, size_t outwidth)
+{
+    T vals[8];
+    for (size_t x = 0; x < outwidth; ++x) {
+        // memcpy avoids unaligned and aliased loads from the byte buffers
+        memcpy(vals, r00 + 2*x*sizeof(T), 2*sizeof(T));
+        memcpy(vals+2, r01 + 2*x*sizeof(T), 2*sizeof(T));
+        memcpy(vals+4, r10 + 2*x*sizeof(T), 2*sizeof(T));
+        memcpy(vals+6, r11 + 2*x*sizeof(T), 2*sizeof(T));
+        T result = mode8<T>(vals);
+        memcpy(out + x*sizeof(T), &result, sizeof(T));
+    }
+}
+
+}
+
+void lowtis::downsample_block(const unsigned char* child, const std::tuple<size_t, size_t, size_t>& blocksize,
+        size_t typesize, unsigned char* parent, int octx, int octy, int octz)
+{
+    size_t halfx = std::get<0>(blocksize) / 2;
+    size_t halfy = std::get<1>(blocksize) / 2;
+    size_t halfz = std::get<2>(blocksize) / 2;
+    size_t rowsize = std::get<0>(blocksize) * typesize;
+    size_t planesize = std::get<1>(blocksize) * rowsize;
+
+    for (size_t z = 0; z < halfz; ++z) {
+        for (size_t y = 0; y < halfy; ++y) {
+            const unsigned char* r00 = child + (2*z)*planesize + (2*y)*rowsize;
+            const unsigned char* r01 = r00 + rowsize;
+            const unsigned char* r10 = r00 + planesize;
+            const unsigned char* r11 = r10 + rowsize;
+
+            unsigned char* out = parent + (octz*halfz + z)*planesize +
+                (octy*halfy + y)*rowsize + octx*halfx*typesize;
+
+            switch (typesize) {
+                case 1:
+                    mean_row(r00, r01, r10, r11, out, halfx);
+                    break;
+                case 2:
+                    mode_row<uint16_t>(r00, r01, r10, r11, out, halfx);
+                    break;
+                case 4:
+                    mode_row<uint32_t>(r00, r01, r10, r11, out, halfx);
+                    break;
+                case 8:
+                    mode_row<uint64_t>(r00, r01, r10, r11, out, halfx);
+                    break;
+                default:
+                    throw LowtisErr("Downsampling not supported for this bytedepth");
+            }
+        }
+    }
+}
+
+void lowtis::fill_octant(const unsigned char* value, const std::tuple<size_t, size_t, size_t>& blocksize,
+        size_t typesize, unsigned char* parent, int octx, int octy, int octz)
+{
+    size_t halfx = std::get<0>(blocksize) / 2;
+    size_t halfy = std::get<1>(blocksize) / 2;
+    size_t halfz = std::get<2>(blocksize) / 2;
+    size_t rowsize = std::get<0>(blocksize) * typesize;
+    size_t planesize = std::get<1>(blocksize) * rowsize;
+
+    for (size_t z = 0; z < halfz; ++z) {
+        for (size_t y = 0; y < halfy; ++y) {
+            unsigned char* out = parent + (octz*halfz + z)*planesize +
+                (octy*halfy + y)*rowsize + octx*halfx*typesize;
+            for (size_t x = 0; x < halfx; ++x) {
+                memcpy(out + x*typesize, value, typesize);
+            }
+        }
+    }
+}
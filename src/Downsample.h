@@ -0,0 +1,43 @@
+#ifndef DOWNSAMPLE_H
+#define DOWNSAMPLE_H
+
+#include <cstddef>
+#include <tuple>
+
+namespace lowtis {
+
+/*!
+ * Downsamples a decoded block by two in each dimension and writes
+ * the result into one octant of a block at the next zoom level.
+ * Grayscale (typesize 1) takes the mean of each 2x2x2 cube and
+ * labels (typesize 2, 4, 8) take the most frequent value (ties go
+ * to the smaller label).  The inner loops are written to be
+ * vectorized by the compiler.
+ * \param child decoded child block
+ * \param blocksize size (x, y, z) of child and parent block (each must be even)
+ * \param typesize bytes per voxel
+ * \param parent decoded parent block to write into
+ * \param octx x position (0 or 1) of the child within the parent
+ * \param octy y position (0 or 1) of the child within the parent
+ * \param octz z position (0 or 1) of the child within the parent
+*/
+void downsample_block(const unsigned char* child, const std::tuple<size_t, size_t, size_t>& blocksize,
+        size_t typesize, unsigned char* parent, int octx, int octy, int octz);
+
+/*!
+ * Fills one octant of a parent block with a single voxel value.
+ * This is the downsampled result of a uniform or empty child.
+ * \param value pointer to typesize bytes of voxel data
+ * \param blocksize size (x, y, z) of parent block
+ * \param typesize bytes per voxel
+ * \param parent decoded parent block to write into
+ * \param octx x position (0 or 1) of the octant
+ * \param octy y position (0 or 1) of the octant
+ * \param octz z position (0 or 1) of the octant
+*/
+void fill_octant(const unsigned char* value, const std::tuple<size_t, size_t, size_t>& blocksize,
+        size_t typesize, unsigned char* parent, int octx, int octy, int octz);
+
+}
+
+#endif
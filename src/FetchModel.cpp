@@ -0,0 +1,55 @@
+#include "FetchModel.h"
+
+using namespace lowtis;
+
+void FetchModel::add_sample(size_t blocks, double milliseconds)
+{
+    if (blocks == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    samples.push_back(std::make_pair(double(blocks), milliseconds));
+    if (samples.size() > MAXSAMPLES) {
+        samples.pop_front();
+    }
+}
+
+bool FetchModel::ready()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !samples.empty();
+}
+
+double FetchModel::predict_ms(double blocks)
+{
+    if (blocks <= 0) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (samples.empty()) {
+        return 0;
+    }
+
+    double n = samples.size();
+    double sumx = 0, sumy = 0, sumxx = 0, sumxy = 0;
+    for (auto iter = samples.begin(); iter != samples.end(); ++iter) {
+        sumx += iter->first;
+        sumy += iter->second;
+        sumxx += iter->first * iter->first;
+        sumxy += iter->first * iter->second;
+    }
+
+    // without different request sizes, only the mean time per block is known
+    double latency = 0;
+    double perblock = sumy / sumx;
+    double denom = n*sumxx - sumx*sumx;
+    if (denom > 1e-9) {
+        double slope = (n*sumxy - sumx*sumy) / denom;
+        double intercept = (sumy - slope*sumx) / n;
+        if ((slope > 0) && (intercept >= 0)) {
+            perblock = slope;
+            latency = intercept;
+        }
+    }
+    return latency + perblock*blocks;
+}
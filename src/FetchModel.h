@@ -0,0 +1,49 @@
+#ifndef FETCHMODEL_H
+#define FETCHMODEL_H
+
+#include <mutex>
+#include <deque>
+#include <utility>
+
+namespace lowtis {
+
+/*!
+ * Predicts how long fetching a number of blocks takes from recent
+ * fetches.  Fetch time is modeled as a fixed request latency plus a
+ * time per block (set by bandwidth), fit by least squares.  Each
+ * function is thread-safe.
+*/
+class FetchModel {
+  public:
+    //! number of recent fetches used for the fit
+    static const size_t MAXSAMPLES = 32;
+
+    /*!
+     * Adds a completed fetch.
+     * \param blocks number of blocks requested
+     * \param milliseconds time taken by the fetch
+    */
+    void add_sample(size_t blocks, double milliseconds);
+
+    /*!
+     * Checks whether any fetch has been measured.
+    */
+    bool ready();
+
+    /*!
+     * Predicts the time to fetch blocks (0 if none are needed).
+     * \param blocks number of blocks to fetch
+     * \return predicted time in milliseconds
+    */
+    double predict_ms(double blocks);
+
+  private:
+    std::mutex mutex;
+
+    //! (blocks, milliseconds) of recent fetches
+    std::deque<std::pair<double, double> > samples;
+};
+
+}
+
+#endif
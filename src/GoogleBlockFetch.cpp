@@ -1,8 +1,12 @@
 #include "GoogleBlockFetch.h"
 #include "BlockCache.h"
 #include <functional>
+#include <exception>
 
 #include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <tuple>
 #include <json/json.h>
 
 using namespace lowtis; using namespace libdvid;
@@ -12,61 +16,74 @@ using std::stringstream;
 using std::min; using std::max;
 using std::ifstream;
 
+// block received by a fetch thread (keyed by BlockCoords)
+struct FetchedBlock {
+    DVIDCompressedBlock block;
+};
+
 struct FetchData {
-    FetchData(DVIDNodeService& service_, string request_, DVIDCompressedBlock& block_,
-                int zoom_, Geometry relshifted_, bool withinvol_,
-                unordered_map<BlockCoords, BlockData>& cache,   
+    FetchData(DVIDNodeService& service_, string request_, const DVIDCompressedBlock& block_,
+                std::tuple<size_t, size_t, size_t> blocksize_, int zoom_, Geometry relshifted_, bool withinvol_,
+                unordered_map<BlockCoords, FetchedBlock>& cache,   
                 int& threads_remaining_, boost::mutex& m_mutex_,
-                boost::condition_variable& m_condition_) : service(service_), request(request_),
-                block(block_), zoom(zoom_), relshifted(relshifted_), withinvol(withinvol_),
+                boost::condition_variable& m_condition_, BlockConsumer& consumer_,
+                std::exception_ptr& error_) : service(service_), request(request_),
+                block(block_), blocksize(blocksize_), zoom(zoom_), relshifted(relshifted_), withinvol(withinvol_),
                 cache(cache), threads_remaining(threads_remaining_), m_mutex(m_mutex_),
-                m_condition(m_condition_) {} 
+                m_condition(m_condition_), consumer(consumer_), error(error_) {} 
 
     void operator()()
+    {
+        // an exception escaping a boost thread terminates the program
+        try {
+            fetch();
+        } catch (...) {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    void fetch()
     {
         auto bdata = service.custom_request(request, BinaryDataPtr(), GET); 
 
-        BlockData data;
+        FetchedBlock data;
         if (withinvol) {
             // just copy to cache
             block.set_data(bdata);
             data.block = block;
         } else {
-            // fill-in block border and compress to lz4
+            // fill-in block border (kept uncompressed so it is not
+            // compressed again only to be decompressed for display)
             unsigned int width, height;
             bdata = BinaryData::decompress_jpeg(bdata, width, height);
 
-            auto offset = block.get_offset();
-
             // make sure volume size matches jpeg size
             size_t volsize = (relshifted.xmax - relshifted.xmin + 1) *
                 (relshifted.ymax - relshifted.ymin + 1) *
                 (relshifted.zmax - relshifted.zmin + 1); 
             assert((width*height == volsize));
 
-            // copy data to new buffer
-            size_t blocksize = block.get_blocksize();
-            char *buffer = new char[blocksize*blocksize*blocksize]();
+            // copy data into zero-filled block
+            size_t bx = std::get<0>(blocksize), by = std::get<1>(blocksize), bz = std::get<2>(blocksize);
+            BinaryDataPtr finaldata = BinaryData::create_binary_data();
+            finaldata->get_data().assign(bx*by*bz, '\0');
+            char *buffer = &(finaldata->get_data()[0]);
 
-            int ptrpos = 0;
             const unsigned char* rawdata = bdata->get_raw();
+            size_t rowsize = relshifted.xmax - relshifted.xmin + 1;
             for (int z = relshifted.zmin; z <= relshifted.zmax; ++z) {
                 for (int y = relshifted.ymin; y <= relshifted.ymax; ++y) {
-                    size_t glbpos = (z)*(blocksize*blocksize) +
-                        (y)*blocksize + relshifted.xmin;
-                    for (int x = relshifted.xmin; x <= relshifted.xmax; ++x) {
-                        buffer[glbpos] = rawdata[ptrpos];
-                        ++glbpos;
-                        ++ptrpos;
-                    }
+                    size_t glbpos = (z)*(bx*by) +
+                        (y)*bx + relshifted.xmin;
+                    memcpy(buffer + glbpos, rawdata, rowsize);
+                    rawdata += rowsize;
                 }
             }
-            auto finaldata = BinaryData::create_binary_data(buffer, blocksize*blocksize*blocksize);
-
-            // re-compress data (now lz4) and save to block         
-            finaldata = BinaryData::compress_lz4(finaldata);
-            DVIDCompressedBlock cblock(finaldata, block.get_offset(), blocksize, block.get_typesize(), DVIDCompressedBlock::lz4);
 
+            DVIDCompressedBlock cblock(finaldata, block.get_offset(), block.get_blocksize(), block.get_typesize(), DVIDCompressedBlock::uncompressed);
             data.block = cblock;
         }
 
@@ -81,30 +98,231 @@ struct FetchData {
         boost::mutex::scoped_lock lock(m_mutex);
         cache[coords] = data;
         threads_remaining--;
+        consumer(data.block);
         //m_condition.notify_one();
     }
 
     DVIDNodeService service;
     string request;
     DVIDCompressedBlock block;
+    std::tuple<size_t, size_t, size_t> blocksize;
     int zoom;
     Geometry relshifted;
     bool withinvol;
-    unordered_map<BlockCoords, BlockData>& cache;
+    unordered_map<BlockCoords, FetchedBlock>& cache;
     int& threads_remaining;
     boost::mutex& m_mutex;
     boost::condition_variable& m_condition;
+    BlockConsumer& consumer;
+    std::exception_ptr& error;
 };
 
 
+// fetches a box of adjacent blocks with one request and splits it into blocks
+struct FetchBox {
+    FetchBox(DVIDNodeService& service_, string request_, const vector<DVIDCompressedBlock>& blocks_,
+                std::tuple<size_t, size_t, size_t> blocksize_, BlockBox box_, int zoom_,
+                unordered_map<BlockCoords, FetchedBlock>& cache_,
+                boost::mutex& m_mutex_, BlockConsumer& consumer_,
+                std::exception_ptr& error_) : service(service_),
+                request(request_), blocks(blocks_), blocksize(blocksize_), box(box_), zoom(zoom_), cache(cache_),
+                m_mutex(m_mutex_), consumer(consumer_), error(error_) {}
+
+    void operator()()
+    {
+        try {
+            fetch();
+        } catch (...) {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    void fetch()
+    {
+        auto bdata = service.custom_request(request, BinaryDataPtr(), GET); 
+        unsigned int width, height;
+        bdata = BinaryData::decompress_jpeg(bdata, width, height);
+
+        // volume is ordered x, y, z
+        size_t bx = std::get<0>(blocksize), by = std::get<1>(blocksize), bz = std::get<2>(blocksize);
+        size_t rowsize = (box.maxpt[0] - box.minpt[0]) * bx;
+        size_t planesize = rowsize * (box.maxpt[1] - box.minpt[1]) * by;
+        assert((size_t(width)*height == box.volume()*bx*by*bz));
+        const unsigned char* rawdata = bdata->get_raw();
+
+        // blocks are re-encoded as lz4 so they take about as much cache
+        // space as the jpeg blocks of single block requests
+        for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+            vector<int> offset = iter->get_offset();
+            size_t relx = offset[0]/bx - box.minpt[0];
+            size_t rely = offset[1]/by - box.minpt[1];
+            size_t relz = offset[2]/bz - box.minpt[2];
+
+            BinaryDataPtr blockdata = BinaryData::create_binary_data();
+            blockdata->get_data().resize(bx*by*bz);
+            char* buffer = &(blockdata->get_data()[0]);
+            for (size_t z = 0; z < bz; ++z) {
+                for (size_t y = 0; y < by; ++y) {
+                    const unsigned char* row = rawdata + (relz*bz + z)*planesize +
+                        (rely*by + y)*rowsize + relx*bx;
+                    memcpy(buffer, row, bx);
+                    buffer += bx;
+                }
+            }
+
+            // jpeg data starts with the SOI marker, so lz4 data that does
+            // too is kept uncompressed (see BlockFetch::wrap_block)
+            FetchedBlock data;
+            BinaryDataPtr lz4data = BinaryData::compress_lz4(blockdata);
+            if (is_jpeg_data(lz4data)) {
+                data.block = DVIDCompressedBlock(blockdata, offset, iter->get_blocksize(),
+                        iter->get_typesize(), DVIDCompressedBlock::uncompressed);
+            } else {
+                data.block = DVIDCompressedBlock(lz4data, offset, iter->get_blocksize(),
+                        iter->get_typesize(), DVIDCompressedBlock::lz4);
+            }
+
+            BlockCoords coords;
+            coords.x = offset[0];
+            coords.y = offset[1];
+            coords.z = offset[2];
+            coords.zoom = zoom;
+
+            boost::mutex::scoped_lock lock(m_mutex);
+            cache[coords] = data;
+            consumer(data.block);
+        }
+    }
+
+    DVIDNodeService service;
+    string request;
+    vector<DVIDCompressedBlock> blocks;
+    std::tuple<size_t, size_t, size_t> blocksize;
+    BlockBox box;
+    int zoom;
+    unordered_map<BlockCoords, FetchedBlock>& cache;
+    boost::mutex& m_mutex;
+    BlockConsumer& consumer;
+    std::exception_ptr& error;
+};
+
+namespace {
+
+// max image height of a decoded jpeg
+const size_t MAXJPEGDIM = 65535;
+
+/*!
+ * Groups blocks into boxes of adjacent blocks (no extra blocks are
+ * included).  Boxes grow along x, then y, then z.
+ * \param blocks blocks to group
+ * \param blocksize size of each block (x, y, z)
+ * \param maxblocks max blocks in a box
+ * \param boxes box for each group
+ * \return block ids of each box (ordered z, y, x)
+*/
+vector<vector<size_t> > coalesce_blocks(const vector<DVIDCompressedBlock>& blocks,
+        std::tuple<size_t, size_t, size_t> blocksize, unsigned int maxblocks, vector<BlockBox>& boxes)
+{
+    vector<vector<size_t> > groups;
+    if (blocks.empty()) {
+        return groups;
+    }
+
+    unordered_map<BlockCoords, size_t> remaining;
+    vector<BlockCoords> coords(blocks.size());
+    for (size_t id = 0; id < blocks.size(); ++id) {
+        vector<int> offset = blocks[id].get_offset();
+        coords[id].x = offset[0] / int(std::get<0>(blocksize));
+        coords[id].y = offset[1] / int(std::get<1>(blocksize));
+        coords[id].z = offset[2] / int(std::get<2>(blocksize));
+        remaining[coords[id]] = id;
+    }
+    vector<size_t> order(blocks.size());
+    for (size_t id = 0; id < order.size(); ++id) {
+        order[id] = id;
+    }
+    std::sort(order.begin(), order.end(), [&coords](size_t id1, size_t id2) {
+        return std::make_tuple(coords[id1].z, coords[id1].y, coords[id1].x) <
+            std::make_tuple(coords[id2].z, coords[id2].y, coords[id2].x);
+    });
+
+    // checks that every block of the box is still ungrouped
+    auto box_available = [&remaining](const BlockBox& box) {
+        BlockCoords coord;
+        for (coord.z = box.minpt[2]; coord.z < box.maxpt[2]; ++coord.z) {
+            for (coord.y = box.minpt[1]; coord.y < box.maxpt[1]; ++coord.y) {
+                for (coord.x = box.minpt[0]; coord.x < box.maxpt[0]; ++coord.x) {
+                    if (remaining.find(coord) == remaining.end()) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    };
+
+    for (auto iter = order.begin(); iter != order.end(); ++iter) {
+        const BlockCoords& start = coords[*iter];
+        if (remaining.find(start) == remaining.end()) {
+            continue;
+        }
+        BlockBox box;
+        box.minpt[0] = start.x; box.minpt[1] = start.y; box.minpt[2] = start.z;
+        box.maxpt[0] = start.x+1; box.maxpt[1] = start.y+1; box.maxpt[2] = start.z+1;
+
+        // grow one axis at a time while the new slab is complete
+        for (int axis = 0; axis < 3; ++axis) {
+            while (true) {
+                BlockBox grown = box;
+                grown.maxpt[axis] += 1;
+                size_t height = (grown.maxpt[1]-grown.minpt[1]) * std::get<1>(blocksize) *
+                    (grown.maxpt[2]-grown.minpt[2]) * std::get<2>(blocksize);
+                if ((grown.volume() > maxblocks) || (height > MAXJPEGDIM)) {
+                    break;
+                }
+                BlockBox slab = grown;
+                slab.minpt[axis] = box.maxpt[axis];
+                if (!box_available(slab)) {
+                    break;
+                }
+                box = grown;
+            }
+        }
+
+        vector<size_t> group;
+        BlockCoords coord;
+        for (coord.z = box.minpt[2]; coord.z < box.maxpt[2]; ++coord.z) {
+            for (coord.y = box.minpt[1]; coord.y < box.maxpt[1]; ++coord.y) {
+                for (coord.x = box.minpt[0]; coord.x < box.maxpt[0]; ++coord.x) {
+                    auto found = remaining.find(coord);
+                    group.push_back(found->second);
+                    remaining.erase(found);
+                }
+            }
+        }
+        groups.push_back(group);
+        boxes.push_back(box);
+    }
+    return groups;
+}
+
+}
+
 GoogleBlockFetch::GoogleBlockFetch(GoogleGrayblkConfig& config) :
-        node_service(config.dvid_server, config.dvid_uuid, config.username, "lowtis") 
+        node_service(config.dvid_server, config.dvid_uuid, config.username, "lowtis"),
+        max_request_blocks(std::max(config.max_request_blocks, 1u))
 {
     // setup default params
     bytedepth = config.bytedepth;
     datatypename = config.datatypename;
     assert(bytedepth == 1);
     blocksize = std::make_tuple(config.isoblksize, config.isoblksize, config.isoblksize);
+    if (std::get<0>(config.blockshape) > 0) {
+        blocksize = config.blockshape;
+    }
     compression_type = DVIDCompressedBlock::jpeg;
   
     // extract geometry 
@@ -137,12 +355,48 @@ GoogleBlockFetch::GoogleBlockFetch(GoogleGrayblkConfig& config) :
 // the zoom level is needed to interact with cache and set proper data source
 void GoogleBlockFetch::extract_specific_blocks(
             vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+{
+    // load data into missing blocks  
+    std::unordered_map<BlockCoords, FetchedBlock> cache;
+    stream_specific_blocks(blocks, zoom, [&](const DVIDCompressedBlock& block) {
+        BlockCoords coords;
+        vector<int> offset = block.get_offset();
+        coords.x = offset[0];
+        coords.y = offset[1];
+        coords.z = offset[2];
+        coords.zoom = zoom;
+        cache[coords].block = block;
+    });
+
+    vector<libdvid::DVIDCompressedBlock> tblocks = blocks;
+    blocks.clear();
+    for (auto iter = tblocks.begin(); iter != tblocks.end(); ++iter) {
+        BlockCoords coords;
+        vector<int> offset = iter->get_offset();
+        coords.x = offset[0];
+        coords.y = offset[1];
+        coords.z = offset[2];
+        coords.zoom = zoom;
+
+        auto dataiter = cache.find(coords);
+        if (dataiter != cache.end()) {
+            blocks.push_back(dataiter->second.block);
+        } else {
+            blocks.push_back(*iter);
+        }
+    }
+}
+
+void GoogleBlockFetch::stream_specific_blocks(
+            const vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer)
 {
     if (blocks.empty()) {
         return;
     }
 
-    std::unordered_map<BlockCoords, BlockData> cache;
+    std::unordered_map<BlockCoords, FetchedBlock> cache;
+    std::exception_ptr error; // first failed request
     
     int multiplier = 1;
     for (int i = 0; i < zoom; ++i) {
@@ -158,9 +412,26 @@ void GoogleBlockFetch::extract_specific_blocks(
     int num_launched = 0;
     const int MAXSIMULT = 50; // some crashes in DVID on mac with a lot of requests
 
+    auto launch = [&](boost::thread* t) {
+        threads->add_thread(t);
+        ++num_launched;
+
+        if (num_launched > MAXSIMULT) {
+            threads->join_all();
+            num_launched = 0;
+            delete threads;
+            threads = new boost::thread_group;
+        }
+    };
+
+    // blocks inside the volume are merged into larger requests
+    vector<DVIDCompressedBlock> interior_blocks;
+
     for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
         // check extents
-        int blocksize = iter->get_blocksize() * multiplier;
+        int bx = int(std::get<0>(blocksize)) * multiplier;
+        int by = int(std::get<1>(blocksize)) * multiplier;
+        int bz = int(std::get<2>(blocksize)) * multiplier;
         vector<int> offset = iter->get_offset();
       
         // shift offset back
@@ -172,12 +443,21 @@ void GoogleBlockFetch::extract_specific_blocks(
         if ((offset[0] > geometry.xmax) ||
             (offset[1] > geometry.ymax) ||
             (offset[2] > geometry.ymax) ||
-            ((offset[0]+blocksize-1) < 0) ||
-            ((offset[1]+blocksize-1) < 0) ||
-            ((offset[2]+blocksize-1) < 0)) {
+            ((offset[0]+bx-1) < 0) ||
+            ((offset[1]+by-1) < 0) ||
+            ((offset[2]+bz-1) < 0)) {
             
+            BlockCoords coords;
+            vector<int> toffset = iter->get_offset();
+            coords.x = toffset[0];
+            coords.y = toffset[1];
+            coords.z = toffset[2];
+            coords.zoom = zoom;
+
             boost::mutex::scoped_lock lock(m_mutex);
             --threads_remaining;
+            cache[coords].block = *iter;
+            consumer(*iter);
             continue;
         }
 
@@ -186,26 +466,26 @@ void GoogleBlockFetch::extract_specific_blocks(
         georig.xmin = offset[0];
         georig.ymin = offset[1];
         georig.zmin = offset[2];
-        georig.xmax = offset[0] + blocksize - 1;
-        georig.ymax = offset[1] + blocksize - 1;
-        georig.zmax = offset[2] + blocksize - 1;
+        georig.xmax = offset[0] + bx - 1;
+        georig.ymax = offset[1] + by - 1;
+        georig.zmax = offset[2] + bz - 1;
 
         Geometry relshifted; // relative shift within downloaded block if needed
         bool withinvol = true;
         if ((offset[0] < 0) ||
             (offset[1] < 0) ||
             (offset[2] < 0) ||
-            ((offset[0]+blocksize-1) > geometry.xmax) ||
-            ((offset[1]+blocksize-1) > geometry.ymax) ||
-            ((offset[2]+blocksize-1) > geometry.zmax) ) {
+            ((offset[0]+bx-1) > geometry.xmax) ||
+            ((offset[1]+by-1) > geometry.ymax) ||
+            ((offset[2]+bz-1) > geometry.zmax) ) {
             withinvol = false;
 
             georig.xmin = max(offset[0], 0);
             georig.ymin = max(offset[1], 0);
             georig.zmin = max(offset[2], 0);
-            georig.xmax = min(offset[0] + blocksize - 1, int(geometry.xmax));
-            georig.ymax = min(offset[1] + blocksize - 1, int(geometry.ymax));
-            georig.zmax = min(offset[2] + blocksize - 1, int(geometry.zmax));
+            georig.xmax = min(offset[0] + bx - 1, int(geometry.xmax));
+            georig.ymax = min(offset[1] + by - 1, int(geometry.ymax));
+            georig.zmax = min(offset[2] + bz - 1, int(geometry.zmax));
         
             // put into rel coordinate system
             relshifted.xmin = (georig.xmin-offset[0]) / multiplier;
@@ -214,7 +494,10 @@ void GoogleBlockFetch::extract_specific_blocks(
             relshifted.xmax = (georig.xmax - georig.xmin + 1) / multiplier - 1;
             relshifted.ymax = (georig.ymax - georig.ymin + 1) / multiplier - 1;
             relshifted.zmax = (georig.zmax - georig.zmin + 1) / multiplier - 1;
-        } 
+        } else if (max_request_blocks > 1) {
+            interior_blocks.push_back(*iter);
+            continue;
+        }
 
         // construct query string
         stringstream url;
@@ -227,45 +510,62 @@ void GoogleBlockFetch::extract_specific_blocks(
 
         // launch thread with url
         //pool->add_task(FetchData(node_service, url.str(), *iter, zoom, relshifted,
-          //          withinvol, cache, threads_remaining, m_mutex, m_condition));
+          //          withinvol, cache, threads_remaining, m_mutex, m_condition, consumer, error));
 
 
-        boost::thread* t = new boost::thread(FetchData(node_service, url.str(), *iter, zoom, relshifted,  withinvol, cache, threads_remaining, m_mutex, m_condition));
-        threads->add_thread(t);
-        //FetchData blah(node_service, url.str(), *iter, zoom, relshifted,  withinvol, cache, threads_remaining, m_mutex, m_condition);
-        //blah();
-        ++num_launched;
+        boost::thread* t = new boost::thread(FetchData(node_service, url.str(), *iter, blocksize, zoom, relshifted,  withinvol, cache, threads_remaining, m_mutex, m_condition, consumer, error));
+        launch(t);
+    }
 
-        if (num_launched > MAXSIMULT) {
-            threads->join_all();
-            num_launched = 0;
-            delete threads;
-            threads = new boost::thread_group;
+    // request boxes of adjacent interior blocks
+    vector<BlockBox> boxes;
+    vector<vector<size_t> > groups = coalesce_blocks(interior_blocks, blocksize, max_request_blocks, boxes);
+    for (size_t id = 0; id < groups.size(); ++id) {
+        vector<DVIDCompressedBlock> boxblocks;
+        for (auto iter = groups[id].begin(); iter != groups[id].end(); ++iter) {
+            boxblocks.push_back(interior_blocks[*iter]);
+        }
+        size_t bx = std::get<0>(blocksize), by = std::get<1>(blocksize), bz = std::get<2>(blocksize);
+
+        stringstream url;
+        url << datatypename << "/raw/0_1_2/";
+        url << (boxes[id].maxpt[0] - boxes[id].minpt[0]) * bx << "_" 
+            << (boxes[id].maxpt[1] - boxes[id].minpt[1]) * by << "_"
+            << (boxes[id].maxpt[2] - boxes[id].minpt[2]) * bz << "/";
+        url << boxes[id].minpt[0] * int(bx) << "_" << boxes[id].minpt[1] * int(by) << "_"
+            << boxes[id].minpt[2] * int(bz);
+        url << "/jpg:80?scale=" << zoom;
+
+        boost::thread* t;
+        if (boxblocks.size() == 1) {
+            // single blocks keep their jpeg data
+            Geometry relshifted;
+            t = new boost::thread(FetchData(node_service, url.str(), boxblocks[0], blocksize, zoom, relshifted, true, cache, threads_remaining, m_mutex, m_condition, consumer, error));
+        } else {
+            t = new boost::thread(FetchBox(node_service, url.str(), boxblocks, blocksize, boxes[id], zoom, cache, m_mutex, consumer, error));
         }
+        launch(t);
     }
 
     // wait for threads to finish
     threads->join_all();
     delete threads;
 
-    // load data into missing blocks  
-    
-    vector<libdvid::DVIDCompressedBlock> tblocks = blocks;
-    blocks.clear();
-    for (auto iter = tblocks.begin(); iter != tblocks.end(); ++iter) {
+    // report failed requests so they can be retried
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    // blocks without data are delivered last
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
         BlockCoords coords;
         vector<int> offset = iter->get_offset();
         coords.x = offset[0];
         coords.y = offset[1];
         coords.z = offset[2];
         coords.zoom = zoom;
-
-        auto dataiter = cache.find(coords);
-        if (dataiter != cache.end()) {
-            blocks.push_back(dataiter->second.block);
-        } else {
-            blocks.push_back(*iter);
+        if (cache.find(coords) == cache.end()) {
+            consumer(*iter);
         }
     }
 }
-
@@ -75,6 +75,26 @@ class GoogleBlockFetch : public BlockFetch {
     void extract_specific_blocks(
             std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom);
 
+    /*!
+     * Retrieves the blocks specified and hands each one to the
+     * consumer as soon as its request completes.
+     * \param blocks blocks to retrieve
+     * \param consumer called for each retrieved block
+    */
+    void stream_specific_blocks(
+            const std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer);
+
+    /*!
+     * Checks whether the zoom level is one of the volume scales.
+     * \param zoom power of two zoom level
+     * \return true if blocks can be fetched at this zoom level
+    */
+    bool has_zoom(int zoom)
+    {
+        return (zoom >= 0) && (size_t(zoom) <= maxlevel);
+    }
+
   private:
     boost::mutex m_mutex;
     boost::condition_variable m_condition;
@@ -83,6 +103,7 @@ class GoogleBlockFetch : public BlockFetch {
     std::string datatypename;
     libdvid::DVIDNodeService node_service;
     size_t maxlevel = 0;
+    unsigned int max_request_blocks;
 };
 
 }
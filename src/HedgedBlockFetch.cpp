@@ -0,0 +1,415 @@
+#include "HedgedBlockFetch.h"
+#include "BlockCache.h"
+#include <libdvid/DVIDException.h>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+
+using namespace lowtis; using namespace libdvid;
+using std::vector; using std::shared_ptr; using std::unordered_map;
+
+namespace lowtis {
+
+/*!
+ * Back-end fetchers and whether each one is running a request.
+*/
+struct FetcherPool {
+    std::mutex mutex;
+    std::condition_variable condition;
+    vector<BlockFetchPtr> fetchers;
+    vector<bool> busy;
+
+    //! makes more back-end fetchers while all are busy
+    std::function<BlockFetchPtr()> create;
+
+    //! largest number of back-end fetchers
+    size_t max_fetchers = 0;
+
+    //! fetchers being made (counted against max_fetchers)
+    size_t num_creating = 0;
+
+    //! request thread last started on each fetcher (joined before reuse)
+    vector<std::thread> requests;
+
+    //! claim an idle fetcher (-1 if none and not waiting)
+    int acquire(bool wait, BlockFetchPtr& fetcher)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            for (size_t id = 0; id < fetchers.size(); ++id) {
+                if (!busy[id]) {
+                    busy[id] = true;
+                    fetcher = fetchers[id];
+                    return id;
+                }
+            }
+            if (create && ((fetchers.size() + num_creating) < max_fetchers)) {
+                // making a fetcher can talk to the server, so other
+                // requests are not held up by the lock meanwhile
+                ++num_creating;
+                lock.unlock();
+                try {
+                    fetcher = create();
+                } catch (...) {
+                    lock.lock();
+                    --num_creating;
+                    condition.notify_all();
+                    throw;
+                }
+                lock.lock();
+                --num_creating;
+                fetchers.push_back(fetcher);
+                busy.push_back(true);
+                requests.push_back(std::thread());
+                return fetchers.size() - 1;
+            }
+            if (!wait) {
+                return -1;
+            }
+            condition.wait(lock);
+        }
+    }
+
+    void release(int id)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy[id] = false;
+        }
+        condition.notify_all();
+    }
+
+    //! run a request on a thread for a claimed fetcher
+    void start(int id, std::function<void ()> request)
+    {
+        // the previous request released the fetcher and is exiting
+        std::thread previous;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            previous = std::move(requests[id]);
+        }
+        if (previous.joinable()) {
+            previous.join();
+        }
+
+        std::thread current(request);
+        std::lock_guard<std::mutex> lock(mutex);
+        requests[id] = std::move(current);
+    }
+
+    //! wait for all request threads to finish
+    void join_all()
+    {
+        vector<std::thread> running;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto iter = requests.begin(); iter != requests.end(); ++iter) {
+                running.push_back(std::move(*iter));
+            }
+        }
+        for (auto iter = running.begin(); iter != running.end(); ++iter) {
+            if (iter->joinable()) {
+                iter->join();
+            }
+        }
+    }
+};
+
+/*!
+ * Durations of recent successful requests.
+*/
+struct LatencyTracker {
+    //! number of requests remembered
+    static const size_t MAXSAMPLES = 100;
+
+    //! fewest requests needed to set a deadline
+    static const size_t MINSAMPLES = 10;
+
+    std::mutex mutex;
+    std::deque<double> samples;
+
+    void record(double milliseconds)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        samples.push_back(milliseconds);
+        if (samples.size() > MAXSAMPLES) {
+            samples.pop_front();
+        }
+    }
+
+    //! duration at the percentile (negative if too few samples)
+    double percentile(double fraction)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (samples.size() < MINSAMPLES) {
+            return -1;
+        }
+        vector<double> sorted(samples.begin(), samples.end());
+        size_t pos = std::min(sorted.size()-1, size_t(fraction*sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin()+pos, sorted.end());
+        return sorted[pos];
+    }
+};
+
+}
+
+namespace {
+
+BlockCoords block_coords(const DVIDCompressedBlock& block)
+{
+    vector<int> offset = block.get_offset();
+    BlockCoords coords;
+    coords.x = offset[0];
+    coords.y = offset[1];
+    coords.z = offset[2];
+    return coords;
+}
+
+/*!
+ * Blocks still owed to the caller, shared by the requests for them.
+*/
+struct FetchState {
+    FetchState(BlockConsumer consumer_, const vector<DVIDCompressedBlock>& blocks) :
+        consumer(consumer_)
+    {
+        for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+            pending[block_coords(*iter)] = *iter;
+        }
+    }
+
+    //! pass the first copy of a block to the caller
+    void deliver(const DVIDCompressedBlock& block)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished) {
+            return;
+        }
+        if (pending.erase(block_coords(block)) == 0) {
+            return;
+        }
+        consumer(block);
+        if (pending.empty()) {
+            condition.notify_all();
+        }
+    }
+
+    //! all blocks delivered or no request left running
+    bool done() const
+    {
+        return pending.empty() || (running == 0);
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    BlockConsumer consumer;
+    unordered_map<BlockCoords, DVIDCompressedBlock> pending;
+    int running = 0;
+    bool finished = false;
+    std::exception_ptr error;
+};
+
+// fetch blocks on a claimed fetcher, passing them to the shared state
+void run_request(shared_ptr<FetchState> state, shared_ptr<FetcherPool> pool,
+        shared_ptr<LatencyTracker> latencies, BlockFetchPtr fetcher,
+        const vector<DVIDCompressedBlock>& blocks, int zoom, int id)
+{
+    auto start = std::chrono::steady_clock::now();
+    try {
+        fetcher->stream_specific_blocks(blocks, zoom,
+                [&state](const DVIDCompressedBlock& block) { state->deliver(block); });
+        latencies->record(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count());
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error) {
+            state->error = std::current_exception();
+        }
+    }
+    pool->release(id);
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    --(state->running);
+    state->condition.notify_all();
+}
+
+// start a request on an idle fetcher (false if none is idle and not waiting);
+// requests only run on their own thread when they can be hedged
+bool launch_request(shared_ptr<FetchState> state, shared_ptr<FetcherPool> pool,
+        shared_ptr<LatencyTracker> latencies, vector<DVIDCompressedBlock> blocks,
+        int zoom, bool wait, bool threaded)
+{
+    BlockFetchPtr fetcher;
+    int id = pool->acquire(wait, fetcher);
+    if (id < 0) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        ++(state->running);
+    }
+
+    if (!threaded) {
+        run_request(state, pool, latencies, fetcher, blocks, zoom, id);
+        return true;
+    }
+    pool->start(id, [state, pool, latencies, fetcher, blocks, zoom, id]() {
+        run_request(state, pool, latencies, fetcher, blocks, zoom, id);
+    });
+    return true;
+}
+
+// only server (5xx) errors and failed connections (no http status)
+// can succeed on a retry; anything else will fail again
+bool is_transient(std::exception_ptr error)
+{
+    try {
+        std::rethrow_exception(error);
+    } catch (DVIDException& err) {
+        int status = err.get_status();
+        return (status < 100) || (status >= 500);
+    } catch (...) {
+        return false;
+    }
+}
+
+}
+
+HedgedBlockFetch::HedgedBlockFetch(LowtisConfig& config,
+        std::function<BlockFetchPtr()> create_fetcher) :
+    pool(new FetcherPool), latencies(new LatencyTracker),
+    hedge_percentile(config.hedge_percentile), max_retries(config.max_retries),
+    retry_backoff(config.retry_backoff)
+{
+    primary = create_fetcher();
+    pool->fetchers.push_back(primary);
+    pool->busy.push_back(false);
+    pool->requests.push_back(std::thread());
+
+    // requests that lose the race keep their fetcher until they finish
+    if (hedge_percentile > 0) {
+        pool->create = create_fetcher;
+        pool->max_fetchers = MAXFETCHERS;
+    }
+
+    bytedepth = primary->get_bytedepth();
+    blocksize = primary->get_blocksize();
+    compression_type = primary->get_compression_type();
+}
+
+HedgedBlockFetch::~HedgedBlockFetch()
+{
+    // requests that lost the race still use the back-end fetchers
+    pool->join_all();
+}
+
+bool HedgedBlockFetch::has_zoom(int zoom)
+{
+    return primary->has_zoom(zoom);
+}
+
+bool HedgedBlockFetch::data_version(uint64_t& version)
+{
+    return primary->data_version(version);
+}
+
+bool HedgedBlockFetch::reports_changed_blocks()
+{
+    return primary->reports_changed_blocks();
+}
+
+bool HedgedBlockFetch::block_changed(const BlockCoords& coords, uint64_t version,
+        uint64_t newversion)
+{
+    return primary->block_changed(coords, version, newversion);
+}
+
+void HedgedBlockFetch::prefetch_blocks(vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+{
+    BlockFetchPtr fetcher;
+    int id = pool->acquire(false, fetcher);
+    if (id < 0) {
+        return;
+    }
+    try {
+        fetcher->prefetch_blocks(blocks, zoom);
+    } catch (...) {
+        // prefetch is only a hint
+    }
+    pool->release(id);
+}
+
+void HedgedBlockFetch::extract_specific_blocks(
+            vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+{
+    unordered_map<BlockCoords, size_t> blockindex;
+    for (size_t id = 0; id < blocks.size(); ++id) {
+        blockindex[block_coords(blocks[id])] = id;
+    }
+
+    stream_specific_blocks(blocks, zoom, [&](const DVIDCompressedBlock& block) {
+        blocks[blockindex[block_coords(block)]] = block;
+    });
+}
+
+void HedgedBlockFetch::stream_specific_blocks(
+            const vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer)
+{
+    if (blocks.empty()) {
+        return;
+    }
+
+    vector<DVIDCompressedBlock> remaining = blocks;
+    for (unsigned int attempt = 0; ; ++attempt) {
+        shared_ptr<FetchState> state(new FetchState(consumer, remaining));
+        launch_request(state, pool, latencies, remaining, zoom, true, hedge_percentile > 0);
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            double deadline = (hedge_percentile > 0) ? latencies->percentile(hedge_percentile) : -1;
+            if ((deadline >= 0) && !state->condition.wait_for(lock,
+                        std::chrono::duration<double, std::milli>(deadline),
+                        [&state] { return state->done(); })) {
+                // reissue blocks that have not arrived
+                vector<DVIDCompressedBlock> undelivered;
+                for (auto iter = state->pending.begin(); iter != state->pending.end(); ++iter) {
+                    undelivered.push_back(iter->second);
+                }
+                lock.unlock();
+                launch_request(state, pool, latencies, undelivered, zoom, false, true);
+                lock.lock();
+            }
+            state->condition.wait(lock, [&state] { return state->done(); });
+
+            // late answers are ignored from now on
+            state->finished = true;
+            if (state->pending.empty()) {
+                return;
+            }
+            error = state->error;
+            remaining.clear();
+            for (auto iter = state->pending.begin(); iter != state->pending.end(); ++iter) {
+                remaining.push_back(iter->second);
+            }
+        }
+
+        if (!error) {
+            // requests ended without these blocks (no data)
+            for (auto iter = remaining.begin(); iter != remaining.end(); ++iter) {
+                consumer(*iter);
+            }
+            return;
+        }
+        if ((attempt >= max_retries) || !is_transient(error)) {
+            std::rethrow_exception(error);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(retry_backoff << attempt));
+    }
+}
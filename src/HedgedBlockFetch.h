@@ -0,0 +1,102 @@
+#ifndef HEDGEDBLOCKFETCH_H
+#define HEDGEDBLOCKFETCH_H
+
+#include "BlockFetch.h"
+#include <lowtis/LowtisConfig.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace lowtis {
+
+struct FetcherPool;
+struct LatencyTracker;
+
+/*!
+ * Wraps back-end fetchers to control tail latency.  Request times
+ * are tracked and, when a request runs past a percentile of recent
+ * times, the undelivered blocks are requested again on a second
+ * back-end fetcher.  Each block is delivered from whichever request
+ * returns it first.  Requests failing with transient errors are
+ * retried with exponential backoff.
+ *
+ * With hedging, each request runs on a thread with its own back-end
+ * fetcher.  A request that loses the race finishes in the background
+ * and its blocks are dropped; more back-end fetchers are made (up to
+ * MAXFETCHERS) while the others are busy.  Without hedging, requests
+ * (and retries) run on the calling thread.
+*/
+class HedgedBlockFetch : public BlockFetch {
+  public:
+    //! largest number of back-end fetchers used for hedged requests
+    static const size_t MAXFETCHERS = 4;
+
+    /*!
+     * Constructor.
+     * \param config contains hedging and retry settings
+     * \param create_fetcher makes a back-end fetcher for the data
+    */
+    HedgedBlockFetch(LowtisConfig& config,
+            std::function<BlockFetchPtr()> create_fetcher);
+
+    /*!
+     * Waits for requests still running in the background.
+    */
+    ~HedgedBlockFetch();
+
+    /*!
+     * Base class virtual function for retrieving blocks specified.
+     * \param blocks loads compressed block data into provided coordinates 
+    */
+    void extract_specific_blocks(
+            std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom);
+
+    /*!
+     * Retrieves blocks with hedged requests and retries.
+     * \param blocks blocks to retrieve
+     * \param consumer called for each retrieved block
+    */
+    void stream_specific_blocks(
+            const std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer);
+
+    /*!
+     * Prefetch on an idle back-end fetcher (skipped if none is idle).
+    */
+    void prefetch_blocks(std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom);
+
+    /*!
+     * Checks zoom level availability with the back-end.
+    */
+    bool has_zoom(int zoom);
+
+    /*!
+     * Reads the data version from the back-end.
+    */
+    bool data_version(uint64_t& version);
+
+    /*!
+     * Asks the back-end whether it reports changed blocks.
+    */
+    bool reports_changed_blocks();
+
+    /*!
+     * Checks for changed blocks with the back-end.
+    */
+    bool block_changed(const BlockCoords& coords, uint64_t version, uint64_t newversion);
+
+  private:
+    //! first back-end fetcher (answers metadata queries)
+    BlockFetchPtr primary;
+
+    std::shared_ptr<FetcherPool> pool;
+    std::shared_ptr<LatencyTracker> latencies;
+
+    double hedge_percentile;
+    unsigned int max_retries;
+    unsigned int retry_backoff;
+};
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+#include "LocalBlockFetch.h"
+#include <lowtis/lowtis.h>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace lowtis; using namespace libdvid;
+using std::string; using std::vector; using std::shared_ptr;
+
+namespace {
+
+const char LOCALMAGIC[] = "LOWTISV1";
+const char LOCALMAGIC2[] = "LOWTISV2";
+const size_t HEADERSIZE = 24;
+const size_t HEADERSIZE2 = 32;
+const size_t INDEXENTRYSIZE = 32;
+
+template <typename T>
+T read_value(const char* ptr)
+{
+    T val;
+    memcpy(&val, ptr, sizeof(T));
+    return val;
+}
+
+bool is_directory(const string& path)
+{
+    struct stat info;
+    return (stat(path.c_str(), &info) == 0) && S_ISDIR(info.st_mode);
+}
+
+bool file_exists(const string& path)
+{
+    struct stat info;
+    return (stat(path.c_str(), &info) == 0) && S_ISREG(info.st_mode);
+}
+
+}
+
+LocalDataset::LocalDataset(string filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw LowtisErr("Could not open local dataset " + filename);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw LowtisErr("Could not read local dataset " + filename);
+    }
+    length = info.st_size;
+    if (length < HEADERSIZE) {
+        close(fd);
+        throw LowtisErr("Local dataset is too small: " + filename);
+    }
+
+    void* addr = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw LowtisErr("Could not memory map local dataset " + filename);
+    }
+    mapping = static_cast<char*>(addr);
+    // blocks are read in viewer order, not sequentially
+    madvise(mapping, length, MADV_RANDOM);
+
+    // parse header (V2 adds a block size for each axis)
+    const char* header = mapping + 8;
+    size_t headersize = HEADERSIZE;
+    if (memcmp(mapping, LOCALMAGIC, 8) == 0) {
+        size_t isoblksize = read_value<uint32_t>(header);
+        blocksize = std::make_tuple(isoblksize, isoblksize, isoblksize);
+        header += 4;
+    } else if ((memcmp(mapping, LOCALMAGIC2, 8) == 0) && (length >= HEADERSIZE2)) {
+        blocksize = std::make_tuple(size_t(read_value<uint32_t>(header)),
+                size_t(read_value<uint32_t>(header + 4)), size_t(read_value<uint32_t>(header + 8)));
+        header += 12;
+        headersize = HEADERSIZE2;
+    } else {
+        munmap(mapping, length);
+        throw LowtisErr("Not a lowtis local dataset: " + filename);
+    }
+    bytedepth = read_value<uint32_t>(header);
+    compression_type = static_cast<DVIDCompressedBlock::CompressType>(
+            read_value<uint32_t>(header + 4));
+    uint32_t num_chunks = read_value<uint32_t>(header + 8);
+
+    if (!std::get<0>(blocksize) || !std::get<1>(blocksize) || !std::get<2>(blocksize)) {
+        munmap(mapping, length);
+        throw LowtisErr("Local dataset block size must be positive: " + filename);
+    }
+    bool cubic = (std::get<0>(blocksize) == std::get<1>(blocksize)) &&
+        (std::get<1>(blocksize) == std::get<2>(blocksize));
+    if (!cubic && (compression_type == DVIDCompressedBlock::gzip_labelarray)) {
+        munmap(mapping, length);
+        throw LowtisErr("Local dataset blocks must be cubes for gzip_labelarray: " + filename);
+    }
+
+    if ((headersize + size_t(num_chunks)*INDEXENTRYSIZE) > length) {
+        munmap(mapping, length);
+        throw LowtisErr("Local dataset index is truncated: " + filename);
+    }
+
+    // load chunk index
+    const char* entry = mapping + headersize;
+    index.reserve(num_chunks);
+    for (uint32_t i = 0; i < num_chunks; ++i, entry += INDEXENTRYSIZE) {
+        BlockCoords coords;
+        coords.x = read_value<int32_t>(entry);
+        coords.y = read_value<int32_t>(entry + 4);
+        coords.z = read_value<int32_t>(entry + 8);
+        ChunkLocation location;
+        location.offset = read_value<uint64_t>(entry + 16);
+        location.size = read_value<uint64_t>(entry + 24);
+        if ((location.offset + location.size) > length) {
+            munmap(mapping, length);
+            throw LowtisErr("Local dataset chunk is out of bounds: " + filename);
+        }
+        index[coords] = location;
+    }
+}
+
+LocalDataset::~LocalDataset()
+{
+    munmap(mapping, length);
+}
+
+bool LocalDataset::find_chunk(const BlockCoords& coords, const char*& data, size_t& size) const
+{
+    BlockCoords key = coords;
+    key.zoom = 0;
+    auto iter = index.find(key);
+    if (iter == index.end()) {
+        return false;
+    }
+    data = mapping + iter->second.offset;
+    size = iter->second.size;
+    return true;
+}
+
+LocalBlockFetch::LocalBlockFetch(LocalVolumeConfig& config)
+{
+    bytedepth = config.bytedepth;
+
+    // open each zoom level
+    if (is_directory(config.path)) {
+        for (int zoom = 0; ; ++zoom) {
+            string filename = config.path + "/s" + std::to_string(zoom) + ".chunks";
+            if (!file_exists(filename)) {
+                break;
+            }
+            datasets.push_back(shared_ptr<LocalDataset>(new LocalDataset(filename)));
+        }
+    } else {
+        datasets.push_back(shared_ptr<LocalDataset>(new LocalDataset(config.path)));
+    }
+    if (datasets.empty()) {
+        throw LowtisErr("No datasets found in local volume " + config.path);
+    }
+
+    blocksize = datasets[0]->blocksize;
+    compression_type = datasets[0]->compression_type;
+
+    for (auto iter = datasets.begin(); iter != datasets.end(); ++iter) {
+        if ((*iter)->bytedepth != bytedepth) {
+            throw LowtisErr("Local volume bytedepth does not match configuration");
+        }
+        if (((*iter)->blocksize != blocksize) || ((*iter)->compression_type != compression_type)) {
+            throw LowtisErr("Local volume datasets must share block size and compression");
+        }
+    }
+}
+
+bool LocalBlockFetch::has_zoom(int zoom)
+{
+    return (zoom >= 0) && (size_t(zoom) < datasets.size());
+}
+
+void LocalBlockFetch::extract_specific_blocks(
+            vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+{
+    if (blocks.empty()) {
+        return;
+    }
+    if (!has_zoom(zoom)) {
+        throw LowtisErr("Trying to request unknown scale level");
+    }
+    const LocalDataset& dataset = *(datasets[zoom]);
+
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        vector<int> offset = iter->get_offset();
+        BlockCoords coords;
+        coords.x = offset[0] / int(std::get<0>(blocksize));
+        coords.y = offset[1] / int(std::get<1>(blocksize));
+        coords.z = offset[2] / int(std::get<2>(blocksize));
+
+        // the compressed chunk is read straight from the mapped pages
+        const char* data = 0;
+        size_t size = 0;
+        if (dataset.find_chunk(coords, data, size)) {
+            iter->set_data(BinaryData::create_binary_data(data, size));
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef LOCALBLOCKFETCH_H
+#define LOCALBLOCKFETCH_H
+
+#include "BlockFetch.h"
+#include "BlockCache.h"
+#include <lowtis/LowtisConfig.h>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+namespace lowtis {
+
+/*!
+ * Location of one compressed chunk within a dataset file.
+*/
+struct ChunkLocation {
+    uint64_t offset;
+    uint64_t size;
+};
+
+/*!
+ * One memory mapped dataset file (a single zoom level).
+ *
+ * File layout (little-endian):
+ *   char[8]  magic "LOWTISV1" (cubic blocks) or "LOWTISV2"
+ *   uint32   blocksize (V1) or uint32 x, y, z block size (V2)
+ *   uint32   bytedepth
+ *   uint32   compression (libdvid DVIDCompressedBlock::CompressType)
+ *   uint32   number of chunks
+ *   per chunk: int32 x, y, z (block coordinates), uint32 unused,
+ *              uint64 offset (from file start), uint64 size
+ *   chunk data
+ * Chunks missing from the index are empty.  Blocks that are not cubes
+ * cannot use gzip_labelarray compression.
+*/
+class LocalDataset {
+  public:
+    /*!
+     * Maps the file and reads its chunk index.
+     * \param filename dataset file
+    */
+    LocalDataset(std::string filename);
+
+    //! unmaps the file
+    ~LocalDataset();
+
+    /*!
+     * Finds the chunk for the given block.
+     * \param coords block coordinates (zoom ignored)
+     * \param data set to the start of the chunk data
+     * \param size set to the size of the chunk data
+     * \return true if the chunk exists
+    */
+    bool find_chunk(const BlockCoords& coords, const char*& data, size_t& size) const;
+
+    //! block size along x, y and z
+    std::tuple<size_t, size_t, size_t> blocksize;
+    size_t bytedepth;
+    libdvid::DVIDCompressedBlock::CompressType compression_type;
+
+  private:
+    LocalDataset(const LocalDataset&);
+    LocalDataset& operator=(const LocalDataset&);
+
+    //! start of memory mapped file
+    char* mapping = nullptr;
+
+    //! size of memory mapped file
+    size_t length = 0;
+
+    //! chunk location by block coordinates
+    std::unordered_map<BlockCoords, ChunkLocation> index;
+};
+
+/*!
+ * Reads blocks from a local chunked volume through memory mapping.
+ * Each zoom level is a separate dataset file (see LocalDataset).
+ * Blocks are read only when requested, so the fetch is bound by disk
+ * speed and the page cache is shared between processes.
+*/
+class LocalBlockFetch : public BlockFetch {
+  public:
+    /*!
+     * Opens every dataset in the volume.
+     * \param config contains the volume path
+    */
+    LocalBlockFetch(LocalVolumeConfig& config);
+
+    /*!
+     * Base class virtual function for retrieving blocks specified.
+     * \param blocks loads compressed block data into provided coordinates 
+    */
+    void extract_specific_blocks(
+            std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom);
+
+    /*!
+     * Checks whether the volume has a dataset for the zoom level.
+     * \param zoom power of two zoom level
+     * \return true if blocks can be fetched at this zoom level
+    */
+    bool has_zoom(int zoom);
+
+  private:
+    //! datasets by zoom level
+    std::vector<std::shared_ptr<LocalDataset> > datasets;
+};
+
+}
+
+#endif
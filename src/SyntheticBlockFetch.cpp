@@ -0,0 +1,265 @@
+#include "SyntheticBlockFetch.h"
+#include <lowtis/lowtis.h>
+#include <libdvid/DVIDException.h>
+#include <boost/algorithm/string.hpp>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+using namespace lowtis; using namespace libdvid;
+using std::string; using std::vector;
+
+namespace {
+
+// mix bits of a coordinate triple into a pseudo-random value
+uint64_t hash_coords(int64_t x, int64_t y, int64_t z)
+{
+    uint64_t val = uint64_t(x)*0x9E3779B97F4A7C15ULL ^ uint64_t(y)*0xC2B2AE3D27D4EB4FULL ^
+        uint64_t(z)*0x165667B19E3779F9ULL;
+    val ^= val >> 31;
+    val *= 0xBF58476D1CE4E5B9ULL;
+    val ^= val >> 27;
+    return val;
+}
+
+// floor division for negative coordinates
+int64_t floor_div(int64_t val, int64_t div)
+{
+    return (val >= 0) ? (val / div) : -((-val + div - 1) / div);
+}
+
+void wait_ms(double milliseconds)
+{
+    if (milliseconds > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(int64_t(milliseconds*1000)));
+    }
+}
+
+// each version edits the label regions in one of EDIT_PERIOD phases
+const uint64_t EDIT_PERIOD = 64;
+
+// blocks covering more label regions are always reported as changed
+const int64_t MAX_CHECKED_REGIONS = 4096;
+
+// start of the simulated edits (shared so that every fetcher agrees)
+std::chrono::steady_clock::time_point version_epoch()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+// last version (at most version) that edited the region (0 if none)
+uint64_t last_edit(uint64_t region, uint64_t version)
+{
+    uint64_t phase = (region >> 8) % EDIT_PERIOD;
+    if (version < phase) {
+        return 0;
+    }
+    return phase + ((version - phase) / EDIT_PERIOD) * EDIT_PERIOD;
+}
+
+}
+
+SyntheticBlockFetch::SyntheticBlockFetch(SyntheticConfig& config) :
+    num_levels(config.num_levels), label_size(config.label_size), latency(config.latency),
+    jitter(config.jitter), bandwidth(config.bandwidth), failure_rate(config.failure_rate),
+    mutation_interval(config.mutation_interval), generator(config.seed)
+{
+    // versions count from the first synthetic fetcher
+    version_epoch();
+
+    bytedepth = config.bytedepth;
+    blocksize = std::make_tuple(config.isoblksize, config.isoblksize, config.isoblksize);
+    if (std::get<0>(config.blockshape) > 0) {
+        blocksize = config.blockshape;
+    }
+    if (!std::get<0>(blocksize) || !std::get<1>(blocksize) || !std::get<2>(blocksize)) {
+        throw LowtisErr("Synthetic block size must be positive");
+    }
+    if ((bytedepth != 1) && (bytedepth != 2) && (bytedepth != 4) && (bytedepth != 8)) {
+        throw LowtisErr("Synthetic back-end supports bytedepth 1, 2, 4 or 8");
+    }
+    if (label_size == 0) {
+        throw LowtisErr("Synthetic label size must be positive");
+    }
+
+    // only formats that libdvid can encode (no gzip_labelarray)
+    string compression_string = config.compression;
+    boost::algorithm::to_lower(compression_string);
+    if (compression_string == "lz4") {
+        compression_type = DVIDCompressedBlock::lz4;
+    } else if (compression_string == "uncompressed") {
+        compression_type = DVIDCompressedBlock::uncompressed;
+    } else if (compression_string == "jpeg") {
+        if (bytedepth != 1) {
+            throw LowtisErr("Synthetic jpeg blocks must have bytedepth 1");
+        }
+        compression_type = DVIDCompressedBlock::jpeg;
+    } else {
+        throw LowtisErr("Synthetic back-end does not support compression: " + config.compression);
+    }
+}
+
+bool SyntheticBlockFetch::has_zoom(int zoom)
+{
+    return (zoom >= 0) && (unsigned(zoom) < num_levels);
+}
+
+uint64_t SyntheticBlockFetch::current_version() const
+{
+    if (mutation_interval <= 0) {
+        return 0;
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - version_epoch()).count();
+    return uint64_t(elapsed / mutation_interval);
+}
+
+bool SyntheticBlockFetch::data_version(uint64_t& version)
+{
+    version = current_version();
+    return true;
+}
+
+bool SyntheticBlockFetch::reports_changed_blocks()
+{
+    return true;
+}
+
+bool SyntheticBlockFetch::block_changed(const BlockCoords& coords, uint64_t version,
+        uint64_t newversion)
+{
+    if ((bytedepth == 1) || (newversion <= version)) {
+        return false;
+    }
+    if ((newversion - version) >= EDIT_PERIOD) {
+        return true;
+    }
+
+    // label regions overlapping the block (in zoom 0 coordinates)
+    int64_t scale = int64_t(1) << coords.zoom;
+    int64_t start[3] = {coords.x, coords.y, coords.z};
+    int64_t size[3] = {int64_t(std::get<0>(blocksize)), int64_t(std::get<1>(blocksize)),
+        int64_t(std::get<2>(blocksize))};
+    int64_t minregion[3], maxregion[3];
+    int64_t num_regions = 1;
+    for (int i = 0; i < 3; ++i) {
+        minregion[i] = floor_div(start[i]*scale, label_size);
+        maxregion[i] = floor_div((start[i] + size[i])*scale - 1, label_size);
+        num_regions *= (maxregion[i] - minregion[i] + 1);
+    }
+    if (num_regions > MAX_CHECKED_REGIONS) {
+        return true;
+    }
+
+    for (int64_t rz = minregion[2]; rz <= maxregion[2]; ++rz) {
+        for (int64_t ry = minregion[1]; ry <= maxregion[1]; ++ry) {
+            for (int64_t rx = minregion[0]; rx <= maxregion[0]; ++rx) {
+                if (last_edit(hash_coords(rx, ry, rz), newversion) > version) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+BinaryDataPtr SyntheticBlockFetch::generate_block(const vector<int>& offset, int zoom,
+        uint64_t version)
+{
+    size_t bx = std::get<0>(blocksize), by = std::get<1>(blocksize), bz = std::get<2>(blocksize);
+    BinaryDataPtr data = BinaryData::create_binary_data();
+    string& raw = data->get_data();
+    raw.resize(bx*by*bz*bytedepth);
+    char* ptr = &raw[0];
+
+    // values are functions of zoom 0 coordinates so levels agree
+    int64_t scale = int64_t(1) << zoom;
+    for (size_t z = 0; z < bz; ++z) {
+        int64_t gz = (offset[2] + int64_t(z)) * scale;
+        for (size_t y = 0; y < by; ++y) {
+            int64_t gy = (offset[1] + int64_t(y)) * scale;
+            for (size_t x = 0; x < bx; ++x) {
+                int64_t gx = (offset[0] + int64_t(x)) * scale;
+                if (bytedepth == 1) {
+                    // texture of 8x8x8 cells over a smooth ramp
+                    uint64_t cell = hash_coords(gx >> 3, gy >> 3, gz >> 3);
+                    *ptr = char(((gx + gy + gz) >> 2) + (cell & 0x3f));
+                } else {
+                    uint64_t region = hash_coords(floor_div(gx, label_size),
+                            floor_div(gy, label_size), floor_div(gz, label_size));
+
+                    // edited regions get a new label (or become background)
+                    uint64_t edit = last_edit(region, version);
+                    if (edit > 0) {
+                        region = hash_coords(int64_t(region), int64_t(edit), 0);
+                    }
+                    uint64_t label = ((region & 3) == 0) ? 0 : (region >> 2);
+                    memcpy(ptr, &label, bytedepth);
+                }
+                ptr += bytedepth;
+            }
+        }
+    }
+
+    if (compression_type == DVIDCompressedBlock::lz4) {
+        return BinaryData::compress_lz4(data);
+    }
+    if (compression_type == DVIDCompressedBlock::jpeg) {
+        // stored as an x by y*z image (lossy, so only for load tests)
+        return BinaryData::compress_jpeg(data, std::get<0>(blocksize),
+                std::get<1>(blocksize)*std::get<2>(blocksize));
+    }
+    return data;
+}
+
+void SyntheticBlockFetch::stream_specific_blocks(
+            const vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer)
+{
+    if (blocks.empty()) {
+        return;
+    }
+
+    // simulate request latency and failure
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    double delay = latency + jitter*(2*distribution(generator) - 1);
+    bool failed = distribution(generator) < failure_rate;
+    wait_ms(delay);
+    if (failed) {
+        throw DVIDException("Synthetic request failed", 503);
+    }
+    if (!has_zoom(zoom)) {
+        throw LowtisErr("Trying to request unknown scale level");
+    }
+
+    // the request sees a single version of the data
+    uint64_t version = current_version();
+
+    auto start = std::chrono::steady_clock::now();
+    double bytes_sent = 0;
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        DVIDCompressedBlock block = *iter;
+        block.set_data(generate_block(iter->get_offset(), zoom, version));
+
+        // deliver once the simulated transfer reaches this block
+        bytes_sent += block.get_datasize();
+        if (bandwidth > 0) {
+            double elapsed = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            wait_ms(bytes_sent / (bandwidth*1000) - elapsed);
+        }
+        consumer(block);
+    }
+}
+
+void SyntheticBlockFetch::extract_specific_blocks(
+            vector<libdvid::DVIDCompressedBlock>& blocks, int zoom)
+{
+    size_t pos = 0;
+    stream_specific_blocks(blocks, zoom, [&](const DVIDCompressedBlock& block) {
+        // blocks are delivered in request order
+        blocks[pos++] = block;
+    });
+}
@@ -0,0 +1,96 @@
+#ifndef SYNTHETICBLOCKFETCH_H
+#define SYNTHETICBLOCKFETCH_H
+
+#include "BlockFetch.h"
+#include <lowtis/LowtisConfig.h>
+#include <random>
+
+namespace lowtis {
+
+/*!
+ * Generates deterministic blocks in process.  Grayscale is a
+ * textured pattern and labels are cuboid regions (a quarter of them
+ * background).  Each call is one simulated request with latency,
+ * jitter, bandwidth and a failure rate, so the whole pipeline can be
+ * stress tested and profiled without a server.  Label edits can be
+ * simulated with a data version that goes up over time (shared by
+ * every synthetic fetcher in the process).
+*/
+class SyntheticBlockFetch : public BlockFetch {
+  public:
+    /*!
+     * Setup block format and request model.
+     * \param config contains block size, compression and request model
+    */
+    SyntheticBlockFetch(SyntheticConfig& config);
+
+    /*!
+     * Base class virtual function for retrieving blocks specified.
+     * \param blocks loads compressed block data into provided coordinates 
+    */
+    void extract_specific_blocks(
+            std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom);
+
+    /*!
+     * Simulates one request.  The first block arrives after the latency
+     * and the rest at the configured bandwidth.  Failed requests throw
+     * before any block is delivered.
+     * \param blocks blocks to retrieve
+     * \param consumer called for each retrieved block
+    */
+    void stream_specific_blocks(
+            const std::vector<libdvid::DVIDCompressedBlock>& blocks, int zoom,
+            BlockConsumer consumer);
+
+    /*!
+     * Checks whether the zoom level is one of the generated levels.
+     * \param zoom power of two zoom level
+     * \return true if blocks can be fetched at this zoom level
+    */
+    bool has_zoom(int zoom);
+
+    /*!
+     * Number of simulated edits so far (0 if edits are disabled).
+    */
+    bool data_version(uint64_t& version);
+
+    /*!
+     * Edited blocks are known from the edited label regions.
+    */
+    bool reports_changed_blocks();
+
+    /*!
+     * Checks whether a label region in the block was edited after
+     * version (grayscale is never edited).
+    */
+    bool block_changed(const BlockCoords& coords, uint64_t version, uint64_t newversion);
+
+  private:
+    /*!
+     * Generates the compressed data for a block.
+     * \param offset offset of block (at zoom)
+     * \param zoom power of two zoom level
+     * \param version data version to generate
+     * \return compressed block data
+    */
+    libdvid::BinaryDataPtr generate_block(const std::vector<int>& offset, int zoom,
+            uint64_t version);
+
+    //! current data version
+    uint64_t current_version() const;
+
+    unsigned int num_levels;
+    size_t label_size;
+    double latency;
+    double jitter;
+    double bandwidth;
+    double failure_rate;
+    double mutation_interval;
+
+    //! generates jitter and failures
+    std::mt19937 generator;
+};
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "Trace.h"
+#include <lowtis/lowtis.h>
+#include <cstring>
+#include <cstdint>
+
+using namespace lowtis;
+using std::string; using std::vector;
+
+namespace {
+
+const char TRACEMAGIC[] = "LOWTRACE";
+const uint32_t TRACEVERSION = 1;
+
+template <typename T>
+void write_value(std::ofstream& fout, T value)
+{
+    fout.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T read_value(std::ifstream& fin)
+{
+    T value = T();
+    fin.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+}
+
+TraceWriter::TraceWriter(string path, size_t bytedepth) :
+    fout(path.c_str(), std::ios::binary | std::ios::trunc),
+    start(std::chrono::steady_clock::now())
+{
+    if (!fout) {
+        throw LowtisErr("Could not create trace file " + path);
+    }
+    fout.write(TRACEMAGIC, 8);
+    write_value<uint32_t>(fout, TRACEVERSION);
+    write_value<uint32_t>(fout, bytedepth);
+}
+
+unsigned long long TraceWriter::since_start(std::chrono::steady_clock::time_point time) const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - start).count();
+}
+
+void TraceWriter::write(const TraceRecord& record)
+{
+    write_value<uint8_t>(fout, record.arbitrary ? 1 : 0);
+    write_value<uint8_t>(fout, record.centercut ? 1 : 0);
+    write_value<int32_t>(fout, record.zoom);
+    write_value<uint32_t>(fout, record.width);
+    write_value<uint32_t>(fout, record.height);
+    for (int i = 0; i < 3; ++i) {
+        write_value<int32_t>(fout, record.location[i]);
+    }
+    if (record.arbitrary) {
+        for (int i = 0; i < 3; ++i) {
+            write_value<double>(fout, record.dim1vec[i]);
+        }
+        for (int i = 0; i < 3; ++i) {
+            write_value<double>(fout, record.dim2vec[i]);
+        }
+    }
+    write_value<uint64_t>(fout, record.start_us);
+    write_value<uint32_t>(fout, record.duration_us);
+
+    // keep the trace usable if the program does not exit cleanly
+    fout.flush();
+}
+
+vector<TraceRecord> lowtis::read_trace(string path, size_t& bytedepth)
+{
+    std::ifstream fin(path.c_str(), std::ios::binary);
+    char magic[8];
+    fin.read(magic, 8);
+    if (!fin || (memcmp(magic, TRACEMAGIC, 8) != 0)) {
+        throw LowtisErr("Not a lowtis trace: " + path);
+    }
+    if (read_value<uint32_t>(fin) != TRACEVERSION) {
+        throw LowtisErr("Unsupported trace version: " + path);
+    }
+    bytedepth = read_value<uint32_t>(fin);
+
+    vector<TraceRecord> records;
+    while (true) {
+        uint8_t kind = read_value<uint8_t>(fin);
+        if (!fin) {
+            break;
+        }
+        TraceRecord record;
+        record.arbitrary = (kind == 1);
+        record.centercut = (read_value<uint8_t>(fin) != 0);
+        record.zoom = read_value<int32_t>(fin);
+        record.width = read_value<uint32_t>(fin);
+        record.height = read_value<uint32_t>(fin);
+        for (int i = 0; i < 3; ++i) {
+            record.location[i] = read_value<int32_t>(fin);
+        }
+        if (record.arbitrary) {
+            for (int i = 0; i < 3; ++i) {
+                record.dim1vec[i] = read_value<double>(fin);
+            }
+            for (int i = 0; i < 3; ++i) {
+                record.dim2vec[i] = read_value<double>(fin);
+            }
+        }
+        record.start_us = read_value<uint64_t>(fin);
+        record.duration_us = read_value<uint32_t>(fin);
+
+        // ignore a record cut short at the end of the file
+        if (!fin) {
+            break;
+        }
+        records.push_back(record);
+    }
+    return records;
+}
@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+
+namespace lowtis {
+
+/*!
+ * One recorded retrieve_image or retrieve_arbimage call.
+*/
+struct TraceRecord {
+    //! retrieve_arbimage call (otherwise retrieve_image)
+    bool arbitrary = false;
+    bool centercut = false;
+    int zoom = 0;
+    unsigned int width = 0;
+    unsigned int height = 0;
+
+    //! image offset (retrieve_image) or center (retrieve_arbimage)
+    int location[3] = {0, 0, 0};
+
+    //! plane orientation (retrieve_arbimage only)
+    double dim1vec[3] = {0, 0, 0};
+    double dim2vec[3] = {0, 0, 0};
+
+    //! time of the call since recording started (in microseconds)
+    unsigned long long start_us = 0;
+
+    //! time taken by the call (in microseconds)
+    unsigned int duration_us = 0;
+};
+
+/*!
+ * Writes retrieve calls to a binary trace file.  The file starts
+ * with the 8-byte magic "LOWTRACE", a uint32 version and a uint32
+ * bytedepth.  Each record is a uint8 kind (0 = image, 1 = arbimage),
+ * uint8 centercut, int32 zoom, uint32 width and height, 3 int32
+ * location values, (arbimage only) 6 float64 orientation values,
+ * uint64 start_us and uint32 duration_us, in host byte order.
+*/
+class TraceWriter {
+  public:
+    /*!
+     * Creates the trace file (overwriting an existing one).
+     * \param path location of trace file
+     * \param bytedepth bytes per pixel of the recorded service
+    */
+    TraceWriter(std::string path, size_t bytedepth);
+
+    /*!
+     * Time since recording started.
+     * \param time time point to convert
+     * \return microseconds since the writer was created
+    */
+    unsigned long long since_start(std::chrono::steady_clock::time_point time) const;
+
+    /*!
+     * Appends a record to the trace.
+    */
+    void write(const TraceRecord& record);
+
+  private:
+    std::ofstream fout;
+    std::chrono::steady_clock::time_point start;
+};
+
+/*!
+ * Reads every record of a binary trace.
+ * \param path location of trace file
+ * \param bytedepth set to bytes per pixel of the recorded service
+ * \return records in call order
+*/
+std::vector<TraceRecord> read_trace(std::string path, size_t& bytedepth);
+
+}
+
+#endif
@@ -2,11 +2,23 @@
 #include "BlockFetch.h"
 #include "BlockFetchFactory.h"
 #include "BlockCache.h"
+#include "Downsample.h"
+#include "BlockTranscoder.h"
+#include "BufferPool.h"
+#include "Trace.h"
+#include "FetchModel.h"
 #include <boost/thread/thread.hpp>
 #include <thread>
 #include <time.h>
 #include <chrono>
 #include <cmath>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <map>
 
 using namespace lowtis;
 using namespace libdvid;
@@ -23,13 +35,91 @@ ImageService::ImageService(LowtisConfig& config_) : config(config_)
     fetcher = create_blockfetcher(&config_);
     fetcher2 = create_blockfetcher(&config_);
     cache = shared_ptr<BlockCache>(new BlockCache);
+    fetch_model = shared_ptr<FetchModel>(new FetchModel);
+
+    // blocks of versioned data stay cached until the data changes
+    try {
+        versioned = fetcher->data_version(data_version);
+    } catch (std::exception& err) {
+        versioned = false;
+    }
+    latest_version = data_version;
+    version_checked = std::chrono::steady_clock::now();
+
+    // (nothing cached yet can be out of date)
     cache->set_timer(config.refresh_rate);
+    if (versioned) {
+        cache->set_timer_cutoff(0);
+    }
     cache->set_max_size(config.cache_size);
 
+    // buffers are taken from the pool by lz4 decoding (into the
+    // uncompressed cache) and by synthesized zoom levels
+    // (merged google requests are split into lz4 blocks)
+    auto googleconfig = dynamic_cast<GoogleGrayblkConfig*>(&config_);
+    bool lz4_decode = (config.uncompressed_cache_size > 0) &&
+        ((fetcher->get_compression_type() == DVIDCompressedBlock::lz4) ||
+         config.transcode_blocks || (googleconfig && (googleconfig->max_request_blocks > 1)));
+    if ((config.buffer_pool_size > 0) && (lz4_decode || (config.synthesize_zoom_levels > 0))) {
+        buffer_pool = shared_ptr<BufferPool>(new BufferPool(config.buffer_pool_size,
+                    config.buffer_pool_hugepages));
+    }
+
     if (config.uncompressed_cache_size > 0) {
         uncompressed_cache = shared_ptr<BlockCache>(new BlockCache);
         uncompressed_cache->set_timer(config.refresh_rate);
+        if (versioned) {
+            uncompressed_cache->set_timer_cutoff(0);
+        }
         uncompressed_cache->set_max_size(config.uncompressed_cache_size);
+        uncompressed_cache->set_pool(buffer_pool);
+    }
+
+    if (config.transcode_blocks) {
+        transcoder = shared_ptr<BlockTranscoder>(new BlockTranscoder(cache));
+    }
+
+    // tiles are cached separately since their keys overlap with blocks
+    tile_fetcher = create_tilefetcher(&config_);
+    if (tile_fetcher) {
+        tile_fetcher2 = create_tilefetcher(&config_);
+        tile_cache = shared_ptr<BlockCache>(new BlockCache);
+        tile_cache->set_timer(config.refresh_rate);
+        tile_cache->set_max_size(config.cache_size);
+        if (config.uncompressed_cache_size > 0) {
+            tile_uncompressed_cache = shared_ptr<BlockCache>(new BlockCache);
+            tile_uncompressed_cache->set_timer(config.refresh_rate);
+            tile_uncompressed_cache->set_max_size(config.uncompressed_cache_size);
+        }
+    }
+
+    // each block is built from 2x2x2 finer blocks
+    std::tuple<size_t, size_t, size_t> blocksize = fetcher->get_blocksize();
+    if ((config.synthesize_zoom_levels > 0) && ((get<0>(blocksize) % 2) ||
+                (get<1>(blocksize) % 2) || (get<2>(blocksize) % 2))) {
+        throw LowtisErr("Zoom levels can only be synthesized from blocks with even dimensions");
+    }
+
+    // the version is read with a separate fetcher so that requests
+    // never wait for it
+    if (versioned) {
+        version_fetcher = create_blockfetcher(&config_);
+        version_thread = shared_ptr<boost::thread>(new boost::thread(
+                    &ImageService::read_versions, this));
+    }
+}
+
+ImageService::~ImageService()
+{
+    cancel_progressive();
+
+    if (version_thread) {
+        {
+            std::lock_guard<std::mutex> lock(version_mutex);
+            version_stop = true;
+        }
+        version_condition.notify_all();
+        version_thread->join();
     }
 }
 
@@ -45,6 +135,102 @@ void ImageService::set_centercut(const std::tuple<int, int>& centercut)
     config.centercut = centercut;
 }
 
+void ImageService::start_recording(std::string path)
+{
+    recorder = shared_ptr<TraceWriter>(new TraceWriter(path, config.bytedepth));
+}
+
+void ImageService::stop_recording()
+{
+    recorder.reset();
+}
+
+ServiceStats ImageService::get_stats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return stats;
+}
+
+void ImageService::reset_stats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats = ServiceStats();
+}
+
+void ImageService::validate_cache()
+{
+    if (!versioned) {
+        return;
+    }
+
+    // use the last version read and ask for a newer one
+    uint64_t version = 0;
+    {
+        std::lock_guard<std::mutex> lock(version_mutex);
+        version = latest_version;
+        if (!version_requested && (std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - version_checked).count() >=
+                    config.version_check_interval)) {
+            version_requested = true;
+            version_condition.notify_one();
+        }
+    }
+    if (version == data_version) {
+        return;
+    }
+
+    uint64_t oldversion = data_version;
+    data_version = version;
+    size_t num_removed = 0;
+    if (fetcher->reports_changed_blocks()) {
+        auto changed = [&](const BlockCoords& coords) {
+            return fetcher->block_changed(coords, oldversion, version);
+        };
+        num_removed = cache->remove_blocks(changed);
+        if (uncompressed_cache) {
+            num_removed += uncompressed_cache->remove_blocks(changed);
+        }
+    } else {
+        // any block cached so far could be out of date, so those blocks
+        // expire after refresh_rate as if the data were not versioned
+        time_t now = time(0);
+        cache->set_timer_cutoff(now);
+        if (uncompressed_cache) {
+            uncompressed_cache->set_timer_cutoff(now);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats.blocks_invalidated += num_removed;
+}
+
+void ImageService::read_versions()
+{
+    std::unique_lock<std::mutex> lock(version_mutex);
+    while (true) {
+        version_condition.wait(lock, [this] { return version_stop || version_requested; });
+        if (version_stop) {
+            return;
+        }
+
+        // the server is not called with the lock held
+        lock.unlock();
+        uint64_t version = 0;
+        bool found = false;
+        try {
+            found = version_fetcher->data_version(version);
+        } catch (std::exception& err) {
+            // keep the cache until the version can be read again
+        }
+        lock.lock();
+
+        if (found) {
+            latest_version = version;
+        }
+        version_checked = std::chrono::steady_clock::now();
+        version_requested = false;
+    }
+}
 
 void ImageService::flush_cache()
 {
@@ -53,45 +239,355 @@ void ImageService::flush_cache()
     if (uncompressed_cache) {
         uncompressed_cache->flush();
     }
+    if (tile_cache) {
+        tile_cache->flush();
+    }
+    if (tile_uncompressed_cache) {
+        tile_uncompressed_cache->flush();
+    }
     gmutex.unlock();
 }
 
-void decompress_block(vector<DVIDCompressedBlock>* blocks, int id, int num_threads, int zoom, shared_ptr<BlockCache> uncompressed_cache)
+
+// holds off block transcoding while a request runs
+struct TranscodePause {
+    TranscodePause(shared_ptr<BlockTranscoder> transcoder_) : transcoder(transcoder_)
+    {
+        if (transcoder) {
+            transcoder->pause();
+        }
+    }
+    ~TranscodePause()
+    {
+        if (transcoder) {
+            transcoder->resume();
+        }
+    }
+    shared_ptr<BlockTranscoder> transcoder;
+};
+
+// time between two time points (in milliseconds)
+double elapsed_ms(std::chrono::high_resolution_clock::time_point start,
+        std::chrono::high_resolution_clock::time_point finish)
+{
+    return std::chrono::duration<double, std::milli>(finish - start).count();
+}
+
+// number of threads used for decompression and downsampling
+int num_worker_threads()
+{
+    int num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0) {
+        // just default to something if hardware concurrency not supported
+        num_threads = 8;
+    }
+    return num_threads;
+}
+
+// decompress a block using (and filling) the uncompressed cache
+Block decode_block(const Block& block, shared_ptr<BlockCache> uncompressed_cache,
+        const BlockFetch* curr_fetcher, bool* cached = 0)
+{
+    // check of block exists in uncompressed_cache 
+    Block dblock;
+    bool found = uncompressed_cache->retrieve_block(block.get_coords(), dblock);
+    if (cached) {
+        *cached = found;
+    }
+    if (found) {
+        return dblock;
+    }
+
+    // check if already decompressed to avoid decompress
+    // (decoded into a recycled buffer when the cache has a pool)
+    shared_ptr<BufferPool> pool = uncompressed_cache->get_pool();
+    BinaryDataPtr uncompressed_data = curr_fetcher->uncompressed_data(block, pool.get());
+    size_t bsize = block.get_blocksize();
+    size_t tsize = block.get_typesize();
+
+    // store blocks of a single value (e.g., background) as that value
+    Block temp_block;
+    if (is_uniform_data(uncompressed_data->get_raw(), uncompressed_data->length(), tsize)) {
+        temp_block = make_uniform_block(uncompressed_data->get_raw(), block.get_coords(), bsize, tsize);
+        if (pool) {
+            pool->release(uncompressed_data);
+        }
+    } else {
+        temp_block = Block(block.get_coords(), bsize, tsize, DVIDCompressedBlock::uncompressed,
+                uncompressed_data);
+    }
+    uncompressed_cache->set_block(temp_block);
+    return temp_block;
+}
+
+// the first num_cached blocks came from the block cache (counted in uncompressed_hits)
+void decompress_block(vector<Block>* blocks, int id, int num_threads, shared_ptr<BlockCache> uncompressed_cache,
+        const BlockFetch* curr_fetcher, size_t num_cached, std::atomic<unsigned int>* uncompressed_hits)
 {
-    BinaryDataPtr uncompressed_data;
     int curr_id = 0;
 
     for (auto iter = blocks->begin(); iter != blocks->end(); ++iter, ++curr_id) {
         if ((curr_id % num_threads) == id) {
             if ((iter->get_data())) {
-                // check of block exists in uncompressed_cache 
-                BlockCoords coords; 
-                vector<int> toffset = iter->get_offset();
-                coords.x = toffset[0];
-                coords.y = toffset[1];
-                coords.z = toffset[2];
-                coords.zoom = zoom;
-
-                DVIDCompressedBlock dblock = *iter;
-                bool found = uncompressed_cache->retrieve_block(coords, dblock);
-               
-                if (!found) {
-                    // check if already decompressed to avoid decompress
-                    uncompressed_data = iter->get_uncompressed_data(); 
-                    size_t bsize = iter->get_blocksize();
-                    size_t tsize = iter->get_typesize();
-
-                    DVIDCompressedBlock temp_block(uncompressed_data, toffset, bsize, tsize, DVIDCompressedBlock::uncompressed);
-                    uncompressed_cache->set_block(temp_block, zoom);
-                    (*blocks)[curr_id] = temp_block;
-                } else {
-                    (*blocks)[curr_id] = dblock;
+                bool cached = false;
+                (*blocks)[curr_id] = decode_block(*iter, uncompressed_cache, curr_fetcher, &cached);
+                if (cached && (size_t(curr_id) < num_cached)) {
+                    ++(*uncompressed_hits);
                 }
             }
         }
     }
 }
 
+/*!
+ * Decodes blocks into the uncompressed cache as they are streamed
+ * from a fetcher, so decompression overlaps with the remaining fetch.
+*/
+class StreamDecoder {
+  public:
+    StreamDecoder(int num_threads, shared_ptr<BlockCache> uncompressed_cache_,
+            const BlockFetch* curr_fetcher_) :
+        uncompressed_cache(uncompressed_cache_), curr_fetcher(curr_fetcher_)
+    {
+        for (int i = 0; i < num_threads; ++i) {
+            threads.add_thread(new boost::thread(&StreamDecoder::run, this));
+        }
+    }
+
+    ~StreamDecoder()
+    {
+        finish();
+    }
+
+    //! queue block for decoding
+    void add_block(const Block& block)
+    {
+        if (!block.get_data()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(block.clone());
+        condition.notify_one();
+    }
+
+    //! wait for queued blocks to be decoded
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (done) {
+                return;
+            }
+            done = true;
+        }
+        condition.notify_all();
+        threads.join_all();
+    }
+
+  private:
+    void run()
+    {
+        while (true) {
+            Block block;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] { return done || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                block = std::move(queue.front());
+                queue.pop_front();
+            }
+            decode_block(block, uncompressed_cache, curr_fetcher);
+        }
+    }
+
+    shared_ptr<BlockCache> uncompressed_cache;
+    const BlockFetch* curr_fetcher;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Block> queue;
+    bool done = false;
+    boost::thread_group threads;
+};
+
+// build each block from its 8 children at the next finer zoom level
+void downsample_blocks(vector<Block>* blocks,
+        const unordered_map<BlockCoords, Block>* children,
+        int id, int num_threads, int zoom, shared_ptr<BlockCache> uncompressed_cache,
+        const BlockFetch* curr_fetcher, BufferPool* pool)
+{
+    int curr_id = 0;
+    std::tuple<size_t, size_t, size_t> blocksize = curr_fetcher->get_blocksize();
+
+    // lz4 blocks that are not cubes can only be decoded by an lz4 fetcher
+    bool compress = curr_fetcher->cubic_blocks() ||
+        (curr_fetcher->get_compression_type() == DVIDCompressedBlock::lz4);
+
+    for (auto iter = blocks->begin(); iter != blocks->end(); ++iter, ++curr_id) {
+        if ((curr_id % num_threads) != id) {
+            continue;
+        }
+        BlockCoords bcoords = iter->get_coords();
+        size_t bsize = iter->get_blocksize();
+        size_t tsize = iter->get_typesize();
+        size_t datasize = curr_fetcher->block_voxels()*tsize;
+
+        // missing children are left as zero
+        BinaryDataPtr parent_data;
+        if (pool) {
+            parent_data = pool->acquire(datasize);
+        } else {
+            parent_data = BinaryData::create_binary_data();
+            parent_data->get_data().assign(datasize, '\0');
+        }
+        unsigned char* parent_raw = reinterpret_cast<unsigned char*>(&(parent_data->get_data()[0]));
+
+        bool foundchild = false;
+        for (int octz = 0; octz < 2; ++octz) {
+            for (int octy = 0; octy < 2; ++octy) {
+                for (int octx = 0; octx < 2; ++octx) {
+                    BlockCoords coords;
+                    coords.x = 2*bcoords.x + octx*int(get<0>(blocksize));
+                    coords.y = 2*bcoords.y + octy*int(get<1>(blocksize));
+                    coords.z = 2*bcoords.z + octz*int(get<2>(blocksize));
+                    coords.zoom = zoom - 1;
+
+                    auto child = children->find(coords);
+                    if ((child == children->end()) || !(child->second.get_data())) {
+                        continue;
+                    }
+                    foundchild = true;
+
+                    Block cblock = child->second.clone();
+                    if (uncompressed_cache) {
+                        uncompressed_cache->retrieve_block(coords, cblock);
+                    }
+
+                    if (is_uniform_block(cblock)) {
+                        fill_octant(cblock.get_data()->get_raw(), blocksize, tsize,
+                                parent_raw, octx, octy, octz);
+                    } else {
+                        BinaryDataPtr child_data = curr_fetcher->uncompressed_data(cblock);
+                        if (child_data->length() < datasize) {
+                            continue;
+                        }
+                        downsample_block(child_data->get_raw(), blocksize, tsize,
+                                parent_raw, octx, octy, octz);
+                    }
+                }
+            }
+        }
+
+        // no data at the finer level means no data at this level
+        if (foundchild) {
+            if (is_uniform_data(parent_raw, datasize, tsize)) {
+                (*blocks)[curr_id] = make_uniform_block(parent_raw, bcoords, bsize, tsize);
+            } else if (compress) {
+                (*blocks)[curr_id] = Block(bcoords, bsize, tsize, DVIDCompressedBlock::lz4,
+                        BinaryData::compress_lz4(parent_data));
+            } else {
+                (*blocks)[curr_id] = Block(bcoords, bsize, tsize, DVIDCompressedBlock::uncompressed,
+                        parent_data);
+            }
+        }
+
+        // buffer is reused unless it was stored
+        if (pool) {
+            pool->release(parent_data);
+        }
+    }
+}
+
+// Write the same pixel value into consecutive pixels of the buffer
+inline void fill_pixels(char* buffer, size_t npixels, const unsigned char* value, size_t bytedepth)
+{
+    if (npixels == 0) {
+        return;
+    }
+    if (bytedepth == 1) {
+        memset(buffer, *value, npixels);
+        return;
+    }
+
+    // copy first pixel and keep doubling the filled region
+    size_t total = npixels * bytedepth;
+    memcpy(buffer, value, bytedepth);
+    size_t filled = bytedepth;
+    while (filled < total) {
+        size_t chunk = std::min(filled, total - filled);
+        memcpy(buffer + filled, buffer, chunk);
+        filled += chunk;
+    }
+}
+
+// Fill in the defaults of a surface holding an image of the given width
+ImageSurface resolve_surface(const ImageSurface& surface, unsigned int width, size_t bytedepth)
+{
+    ImageSurface resolved = surface;
+    if (resolved.pixeldepth == 0) {
+        resolved.pixeldepth = bytedepth;
+    }
+    if (resolved.pixeldepth > bytedepth) {
+        throw LowtisErr("Surface pixel depth cannot be larger than the bytedepth");
+    }
+    if (resolved.rowstride == 0) {
+        resolved.rowstride = width * resolved.pixeldepth;
+    }
+    return resolved;
+}
+
+// Pointer to the first pixel of an image row in the surface
+inline char* surface_row(const ImageSurface& surface, unsigned int row)
+{
+    return surface.buffer + (size_t(surface.yoffset) + row)*surface.rowstride +
+        size_t(surface.xoffset)*surface.pixeldepth;
+}
+
+/*!
+ * Upsamples a packed low-resolution image into the surface by
+ * writing each pixel into a square of 2^shift pixels, except for
+ * pixels inside the skipped rectangle.
+*/
+void upsample_pixels(const char* lowbuffer, unsigned int lowwidth, unsigned int lowheight,
+        int shift, size_t bytedepth, const ImageSurface& surface, unsigned int skipx,
+        unsigned int skipy, unsigned int skipwidth, unsigned int skipheight)
+{
+    for (unsigned int j = 0; j < (lowheight << shift); j++) {
+        const char* lowiter = lowbuffer + ((j >> shift)*lowwidth*bytedepth);
+        char* bufferiter = surface_row(surface, j);
+        bool skiprow = (j >= skipy) && (j < skipy+skipheight);
+        for (unsigned int i = 0; i < (lowwidth << shift); i++) {
+            if (skiprow && (i >= skipx) && (i < skipx+skipwidth)) {
+                // skip to end of the rectangle
+                bufferiter += (skipx + skipwidth - i)*surface.pixeldepth;
+                i = skipx + skipwidth - 1;
+                continue;
+            }
+            memcpy(bufferiter, lowiter + (i >> shift)*bytedepth, surface.pixeldepth);
+            bufferiter += surface.pixeldepth;
+        }
+    }
+}
+
+// Copy pixels into the buffer keeping the lowest pixeldepth bytes of each
+inline void copy_pixels(char* buffer, const unsigned char* src, size_t npixels,
+        size_t bytedepth, size_t pixeldepth)
+{
+    if (bytedepth == pixeldepth) {
+        memcpy(buffer, src, npixels*bytedepth);
+    } else if ((bytedepth == 8) && (pixeldepth == 4)) {
+        // common label conversion (uint64 to uint32)
+        for (size_t i = 0; i < npixels; ++i) {
+            memcpy(buffer + i*4, src + i*8, 4);
+        }
+    } else {
+        for (size_t i = 0; i < npixels; ++i) {
+            memcpy(buffer + i*pixeldepth, src + i*bytedepth, pixeldepth);
+        }
+    }
+}
+
 // Update currloc based on vector step (just rounds to nearest integer location)
 inline void increment_vector(vector<int>& currloc, vector<double>& dim1unitvec,
        vector<double>& dim2unitvec, vector<double>& dim3unitvec,
@@ -103,9 +599,10 @@ inline void increment_vector(vector<int>& currloc, vector<double>& dim1unitvec,
 }
 
 
-void ImageService::retrieve_arbimage(unsigned int width, unsigned int height,
-        vector<int> centerloc, vector<double> dim1vec, vector<double> dim2vec, char* buffer, int zoom,
-        bool centercut)
+// find the corner offset and unit steps of an arbitrary plane
+void arb_plane(unsigned int width, unsigned int height, const vector<int>& centerloc,
+        const vector<double>& dim1vec, const vector<double>& dim2vec, int zoom,
+        vector<int>& offset, vector<double>& dim1step, vector<double>& dim2step)
 {
     // check if roughly orthogonal
     assert(centerloc.size() == 3);
@@ -126,8 +623,8 @@ void ImageService::retrieve_arbimage(unsigned int width, unsigned int height,
     }*/
     
     // calculate unit vector 
-    vector<double> dim1step;
-    vector<double> dim2step;
+    dim1step.clear();
+    dim2step.clear();
     double dim1norm = 0;
     double dim2norm = 0;
     for (int i = 0; i < 3; ++i) {
@@ -149,7 +646,7 @@ void ImageService::retrieve_arbimage(unsigned int width, unsigned int height,
     }
 
     // calculate offset in global coordinates along dim1 and dim2
-    vector<int> offset = centerloc;
+    offset = centerloc;
     vector<double> dummyvec(3,0);
 
     int offset0 = -1*int(width)/2;
@@ -160,27 +657,717 @@ void ImageService::retrieve_arbimage(unsigned int width, unsigned int height,
     }
 
     increment_vector(offset, dim1step, dim2step, dummyvec, offset0, offset1, 0);
+}
+
+void ImageService::retrieve_arbimage(unsigned int width, unsigned int height,
+        vector<int> centerloc, vector<double> dim1vec, vector<double> dim2vec, char* buffer, int zoom,
+        bool centercut, RetrieveReport* report)
+{
+    ImageSurface surface;
+    surface.buffer = buffer;
+    retrieve_arbimage(width, height, centerloc, dim1vec, dim2vec, surface, zoom, centercut, report);
+}
+
+void ImageService::retrieve_arbimage(unsigned int width, unsigned int height,
+        vector<int> centerloc, vector<double> dim1vec, vector<double> dim2vec,
+        const ImageSurface& surface, int zoom, bool centercut, RetrieveReport* report)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    RetrieveReport call_report;
+
+    vector<int> offset;
+    vector<double> dim1step, dim2step;
+    arb_plane(width, height, centerloc, dim1vec, dim2vec, zoom, offset, dim1step, dim2step);
+
+    _retrieve_image_fovea(width, height, offset, resolve_surface(surface, width, config.bytedepth),
+            zoom, centercut, dim1step, dim2step, &call_report); 
 
-    _retrieve_image_fovea(width, height, offset, buffer, zoom, centercut, dim1step, dim2step); 
+    call_report.total_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start_time).count();
+    update_stats(call_report);
+    if (report) {
+        *report = call_report;
+    }
+
+    if (recorder) {
+        TraceRecord record;
+        record.arbitrary = true;
+        for (int i = 0; i < 3; ++i) {
+            record.location[i] = centerloc[i];
+            record.dim1vec[i] = dim1vec[i];
+            record.dim2vec[i] = dim2vec[i];
+        }
+        record_call(record, width, height, zoom, centercut, start_time);
+    }
 }
 
 void ImageService::retrieve_image(unsigned int width,
-        unsigned int height, vector<int> offset, char* buffer, int zoom, bool centercut)
+        unsigned int height, vector<int> offset, char* buffer, int zoom, bool centercut,
+        RetrieveReport* report)
+{
+    ImageSurface surface;
+    surface.buffer = buffer;
+    retrieve_image(width, height, offset, surface, zoom, centercut, report);
+}
+
+void ImageService::retrieve_image(unsigned int width,
+        unsigned int height, vector<int> offset, const ImageSurface& surface, int zoom, bool centercut,
+        RetrieveReport* report)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    RetrieveReport call_report;
+    vector<double> dim1step, dim2step;
+    _retrieve_image_fovea(width, height, offset, resolve_surface(surface, width, config.bytedepth),
+            zoom, centercut, dim1step, dim2step, &call_report); 
+
+    call_report.total_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start_time).count();
+    update_stats(call_report);
+    if (report) {
+        *report = call_report;
+    }
+
+    if (recorder) {
+        TraceRecord record;
+        for (int i = 0; i < 3; ++i) {
+            record.location[i] = offset[i];
+        }
+        record_call(record, width, height, zoom, centercut, start_time);
+    }
+}
+
+void ImageService::retrieve_image_stack(unsigned int width, unsigned int height,
+        unsigned int depth, vector<int> offset, char* buffer, int zoom, RetrieveReport* report)
+{
+    vector<double> dim1step, dim2step;
+    _retrieve_stack(width, height, depth, offset, buffer, zoom, dim1step, dim2step, report);
+}
+
+void ImageService::retrieve_subvolume(vector<unsigned int> dims, vector<int> offset,
+        char* buffer, int zoom, RetrieveReport* report)
+{
+    if ((dims.size() != 3) || (offset.size() != 3)) {
+        throw LowtisErr("Subvolume size and offset must be 3D");
+    }
+
+    // a subvolume is a stack of its xy planes
+    vector<double> dim1step, dim2step;
+    _retrieve_stack(dims[0], dims[1], dims[2], offset, buffer, zoom, dim1step, dim2step, report);
+}
+
+void ImageService::retrieve_arbimage_stack(unsigned int width, unsigned int height,
+        unsigned int depth, vector<int> centerloc, vector<double> dim1vec,
+        vector<double> dim2vec, char* buffer, int zoom, RetrieveReport* report)
+{
+    vector<int> offset;
+    vector<double> dim1step, dim2step;
+    arb_plane(width, height, centerloc, dim1vec, dim2vec, zoom, offset, dim1step, dim2step);
+    _retrieve_stack(width, height, depth, offset, buffer, zoom, dim1step, dim2step, report);
+}
+
+void ImageService::record_call(TraceRecord& record, unsigned int width, unsigned int height,
+        int zoom, bool centercut, std::chrono::steady_clock::time_point start_time)
+{
+    auto end_time = std::chrono::steady_clock::now();
+    record.width = width;
+    record.height = height;
+    record.zoom = zoom;
+    record.centercut = centercut;
+    record.start_us = recorder->since_start(start_time);
+    record.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            end_time - start_time).count();
+    recorder->write(record);
+}
+
+void ImageService::update_stats(const RetrieveReport& report)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    ++stats.requests;
+    stats.blocks += report.blocks;
+    stats.cache_hits += report.cache_hits;
+    stats.blocks_fetched += report.blocks_fetched;
+    stats.bytes_fetched += report.bytes_fetched;
+}
+
+// floor of a / b for b > 0
+int floor_div(int a, int b)
+{
+    return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+// decoded block referenced while compositing an arbitrary cut
+struct MappedBlock {
+    BinaryDataPtr data;
+    bool uniform = false;
+};
+
+// decoded blocks sorted by coordinates (which leave out the zoom)
+typedef vector<std::pair<BlockCoords, MappedBlock> > MappedBlocks;
+
+// find a mapped block by coordinates (null if not mapped)
+const MappedBlock* find_mapped(const MappedBlocks& mappedblocks, const BlockCoords& coords)
+{
+    auto iter = std::lower_bound(mappedblocks.begin(), mappedblocks.end(), coords,
+            [](const std::pair<BlockCoords, MappedBlock>& entry, const BlockCoords& key) {
+                return entry.first < key;
+            });
+    if ((iter == mappedblocks.end()) || !(iter->first == coords)) {
+        return nullptr;
+    }
+    return &(iter->second);
+}
+
+// map blocks by coordinates, decoding them with the given number of threads
+// (one allocation for the whole list instead of a hash node per block)
+void map_blocks(const vector<Block>& blocks, const BlockFetch* curr_fetcher,
+        int num_threads, MappedBlocks& mappedblocks)
+{
+    mappedblocks.clear();
+    mappedblocks.resize(blocks.size());
+
+    auto decode = [&](int id) {
+        for (size_t i = id; i < blocks.size(); i += num_threads) {
+            const Block& block = blocks[i];
+            std::pair<BlockCoords, MappedBlock>& entry = mappedblocks[i];
+            entry.first = block.get_coords();
+            entry.first.zoom = 0;
+            if (is_uniform_block(block)) {
+                entry.second.data = block.get_data();
+                entry.second.uniform = true;
+            } else if (block.get_data()) {
+                entry.second.data = curr_fetcher->uncompressed_data(block);
+            }
+        }
+    };
+
+    if (num_threads <= 1) {
+        decode(0);
+    } else {
+        boost::thread_group threads; // destructor auto deletes threads
+        for (int i = 0; i < num_threads; ++i) {
+            threads.add_thread(new boost::thread(decode, i));
+        }
+        threads.join_all();
+    }
+
+    std::sort(mappedblocks.begin(), mappedblocks.end(),
+            [](const std::pair<BlockCoords, MappedBlock>& entry1,
+                const std::pair<BlockCoords, MappedBlock>& entry2) {
+                return entry1.first < entry2.first;
+            });
+}
+
+// decode blocks in place (without caching) with the given number of threads
+void decode_blocks(vector<Block>& blocks, const BlockFetch* curr_fetcher,
+        int num_threads)
+{
+    auto decode = [&](int id) {
+        for (size_t i = id; i < blocks.size(); i += num_threads) {
+            Block& block = blocks[i];
+            if (!block.get_data() || is_uniform_block(block)) {
+                continue;
+            }
+            block = Block(block.get_coords(), block.get_blocksize(), block.get_typesize(),
+                    DVIDCompressedBlock::uncompressed, curr_fetcher->uncompressed_data(block));
+        }
+    };
+
+    boost::thread_group threads; // destructor auto deletes threads
+    for (int i = 0; i < num_threads; ++i) {
+        threads.add_thread(new boost::thread(decode, i));
+    }
+    threads.join_all();
+}
+
+/*!
+ * Samples an arbitrary plane from mapped blocks by rounding each
+ * pixel to the nearest voxel.  Pixels without data are not written.
+*/
+void sample_plane(const MappedBlocks& mappedblocks,
+        vector<double> toffset, const vector<double>& dim1step, const vector<double>& dim2step,
+        unsigned int width, unsigned int height, const std::tuple<size_t, size_t, size_t>& blocksize,
+        size_t bytedepth, const ImageSurface& surface)
+{
+    // all blocks have the shape of the fetcher
+    int bx = get<0>(blocksize), by = get<1>(blocksize), bz = get<2>(blocksize);
+
+    const unsigned char* raw_data = nullptr;
+    bool uniform = false;
+    BlockCoords pre_coords;
+    pre_coords.x = INT32_MIN;
+    pre_coords.y = INT32_MIN;
+    pre_coords.z = INT32_MIN;
+
+    for (int dim2 = 0; dim2 < height; ++dim2) {
+        char* buffer = surface_row(surface, dim2);
+        for (int dim1 = 0; dim1 < width; ++dim1) {
+            // grab block address
+            int x = static_cast<int>(toffset[0] + 0.5);
+            int y = static_cast<int>(toffset[1] + 0.5);
+            int z = static_cast<int>(toffset[2] + 0.5);
+            // find offset within block
+            int xshift = x - floor_div(x, bx)*bx;
+            int yshift = y - floor_div(y, by)*by;
+            int zshift = z - floor_div(z, bz)*bz;
+
+            BlockCoords coords;
+            coords.x = x - xshift;
+            coords.y = y - yshift;
+            coords.z = z - zshift;
+
+            if (!(pre_coords == coords))
+            {
+                const MappedBlock* mapped = find_mapped(mappedblocks, coords);
+                raw_data = nullptr;
+                uniform = false;
+                if (mapped && mapped->data) {
+                    raw_data = mapped->data->get_raw();
+                    uniform = mapped->uniform;
+                }
+                pre_coords = coords;
+            }
+
+            // don't write data if empty
+            if (raw_data) {
+                const unsigned char*  raw_data_local = raw_data;
+                if (!uniform) {
+                    raw_data_local += ((size_t(zshift)*by + yshift)*bx + xshift)*bytedepth;
+                }
+
+                // write lowest bytes of the pixel
+                memcpy(buffer, raw_data_local, surface.pixeldepth);
+            }
+            buffer += surface.pixeldepth;
+
+            toffset[0] += dim1step[0];
+            toffset[1] += dim1step[1];
+            toffset[2] += dim1step[2];
+        }
+        toffset[0] -= (width*dim1step[0]);
+        toffset[1] -= (width*dim1step[1]);
+        toffset[2] -= (width*dim1step[2]);
+
+        toffset[0] += (dim2step[0]);
+        toffset[1] += (dim2step[1]);
+        toffset[2] += (dim2step[2]);
+    }
+}
+
+/*!
+ * Writes the part of a block inside a stack of orthogonal planes
+ * starting at offset.  Plane i of the stack starts planestride bytes
+ * after plane i-1 in the surface.
+*/
+void composite_block(const Block& block, const BlockFetch* curr_fetcher,
+        const vector<int>& offset, unsigned int width, unsigned int height, unsigned int depth,
+        const unsigned char* emptypixel, size_t bytedepth, const ImageSurface& surface,
+        size_t planestride)
+{
+    std::tuple<size_t, size_t, size_t> blocksize = curr_fetcher->get_blocksize();
+    int bx = get<0>(blocksize), by = get<1>(blocksize), bz = get<2>(blocksize);
+    size_t blockbytes = curr_fetcher->block_voxels() * bytedepth;
+
+    // empty and uniform blocks are filled from a single pixel value
+    const unsigned char* fillval = 0;
+    const unsigned char* raw_data = 0;
+
+    BinaryDataPtr raw_data_ptr;
+    if (!(block.get_data())) {
+        fillval = emptypixel;
+    } else if (is_uniform_block(block)) {
+        fillval = block.get_data()->get_raw();
+    } else {
+        raw_data_ptr = curr_fetcher->uncompressed_data(block);
+        raw_data = raw_data_ptr->get_raw();
+        if (raw_data_ptr->length() < blockbytes) {
+            fillval = emptypixel;
+        }
+    }
+
+    // find intersection between block and buffer
+    const BlockCoords& toffset = block.get_coords();
+    int startx = std::max(offset[0], toffset.x);
+    int finishx = std::min(offset[0]+int(width), toffset.x+bx);
+    int starty = std::max(offset[1], toffset.y);
+    int finishy = std::min(offset[1]+int(height), toffset.y+by);
+    int startz = std::max(offset[2], toffset.z);
+    int finishz = std::min(offset[2]+int(depth), toffset.z+bz);
+
+    size_t rowpixels = finishx - startx;
+    for (int zpos = startz; zpos < finishz; ++zpos) {
+        const unsigned char* plane_data = raw_data;
+        if (!fillval) {
+            // point to correct plane and y,x
+            plane_data += ((size_t(zpos-toffset.z)*by + (starty-toffset.y))*bx +
+                    (startx-toffset.x))*bytedepth;
+        }
+        char* bytebuffer_temp = surface_row(surface, starty-offset[1]) +
+            (zpos-offset[2])*planestride + ((startx-offset[0])*surface.pixeldepth); 
+
+        for (int ypos = starty; ypos < finishy; ++ypos) {
+            if (fillval) {
+                fill_pixels(bytebuffer_temp, rowpixels, fillval, surface.pixeldepth);
+            } else {
+                copy_pixels(bytebuffer_temp, plane_data, rowpixels, bytedepth, surface.pixeldepth);
+                plane_data += bx*bytedepth;
+            }
+            bytebuffer_temp += surface.rowstride;
+        }
+    }
+}
+
+void ImageService::select_tiles(shared_ptr<BlockFetch>& curr_fetcher, shared_ptr<BlockCache>& curr_cache,
+        shared_ptr<BlockCache>& curr_uncompressed_cache, int zoom, const vector<double>& dim1step)
+{
+    if (!tile_fetcher || !dim1step.empty() || !tile_fetcher->has_zoom(zoom)) {
+        return;
+    }
+
+    // the fovea uses both fetchers at once
+    if (curr_fetcher == fetcher) {
+        curr_fetcher = tile_fetcher;
+    } else if (curr_fetcher == fetcher2) {
+        curr_fetcher = tile_fetcher2;
+    } else {
+        return;
+    }
+    curr_cache = tile_cache;
+    curr_uncompressed_cache = tile_uncompressed_cache;
+}
+
+double ImageService::missing_fraction(unsigned int width, unsigned int height, vector<int> offset,
+        int zoom, shared_ptr<BlockFetch> curr_fetcher, vector<double> dim1step,
+        vector<double> dim2step, size_t& num_blocks)
 {
+    shared_ptr<BlockCache> curr_cache = cache;
+    shared_ptr<BlockCache> curr_uncompressed_cache = uncompressed_cache;
+    select_tiles(curr_fetcher, curr_cache, curr_uncompressed_cache, zoom, dim1step);
+
+    // same offset adjustment as _retrieve_image
+    for (int i = 0; i < zoom; i++) {
+        offset[0] /= 2;
+        offset[1] /= 2;
+        offset[2] /= 2;
+    }
+
+    vector<BlockCoords> coords_list;
+    if (dim1step.empty()) {
+        // orthogonal blocks are enumerated directly
+        std::tuple<size_t, size_t, size_t> blocksize = curr_fetcher->get_blocksize();
+        int bx = get<0>(blocksize), by = get<1>(blocksize), bz = get<2>(blocksize);
+        BlockCoords coords;
+        coords.zoom = zoom;
+        coords.z = floor_div(offset[2], bz) * bz;
+        for (int y = floor_div(offset[1], by); y <= floor_div(offset[1]+int(height)-1, by); ++y) {
+            for (int x = floor_div(offset[0], bx); x <= floor_div(offset[0]+int(width)-1, bx); ++x) {
+                coords.x = x * bx;
+                coords.y = y * by;
+                coords_list.push_back(coords);
+            }
+        }
+    } else {
+        vector<unsigned int> dims;
+        dims.push_back(width);
+        dims.push_back(height);
+        dims.push_back(1);
+        vector<double> dim3step(3, 0);
+        vector<Block> blocks = curr_fetcher->intersecting_blocks(dims, offset, dim1step, dim2step,
+                dim3step, zoom);
+        for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+            coords_list.push_back(iter->get_coords());
+        }
+    }
+
+    num_blocks = coords_list.size();
+    if (coords_list.empty()) {
+        return 0;
+    }
+    // blocks still decoded in the uncompressed cache need no fetch either
+    size_t missing = 0;
+    for (auto iter = coords_list.begin(); iter != coords_list.end(); ++iter) {
+        if (!curr_cache->has_block(*iter) &&
+                !(curr_uncompressed_cache && curr_uncompressed_cache->has_block(*iter))) {
+            ++missing;
+        }
+    }
+    return double(missing) / coords_list.size();
+}
+
+void ImageService::plan_fovea(unsigned int width, unsigned int height, vector<int> offset,
+        int zoom, vector<double> dim1step, vector<double> dim2step,
+        bool& centercut, unsigned int& cwidth, unsigned int& cheight, int& lowzoom)
+{
+    if (!fetch_model->ready()) {
+        return;
+    }
+    double target = config.fovea_target_ms;
+
+    // a fast enough fetch (or cache) makes the low-resolution pass wasted work
+    size_t num_blocks = 0;
+    double missing = missing_fraction(width, height, offset, zoom, fetcher,
+            dim1step, dim2step, num_blocks);
+    if (fetch_model->predict_ms(missing*num_blocks) <= target) {
+        centercut = false;
+        return;
+    }
+
+    // largest center (with the shape of the image) expected within the target;
+    // the number of blocks is estimated from the center area
+    std::tuple<size_t, size_t, size_t> blocksize = fetcher->get_blocksize();
+    double bx = get<0>(blocksize), by = get<1>(blocksize);
+    int percent = 90;
+    for (; percent > 10; percent -= 5) {
+        double cw = width * percent / 100.0;
+        double ch = height * percent / 100.0;
+        double blocks = (cw/bx + 1) * (ch/by + 1) * missing;
+        if (fetch_model->predict_ms(blocks) <= target) {
+            break;
+        }
+    }
+    cwidth = width * percent / 100;
+    cheight = height * percent / 100;
+
+    // finest surround expected within the target
+    lowzoom = zoom + 1;
+    for (int level = zoom + 1; level <= zoom + int(config.fovea_max_zoom_offset); ++level) {
+        unsigned int lowwidth = width >> (level - zoom);
+        unsigned int lowheight = height >> (level - zoom);
+        if ((lowwidth == 0) || (lowheight == 0) || !fetcher2->has_zoom(level)) {
+            break;
+        }
+        lowzoom = level;
+        double lowmissing = missing_fraction(lowwidth, lowheight, offset, level, fetcher2,
+                dim1step, dim2step, num_blocks);
+        if (fetch_model->predict_ms(lowmissing*num_blocks) <= target) {
+            break;
+        }
+    }
+}
+
+// add the counts and phase times of a fovea pass
+void merge_report(RetrieveReport& dest, const RetrieveReport& src)
+{
+    dest.cache_ms += src.cache_ms;
+    dest.fetch_ms += src.fetch_ms;
+    dest.decompress_ms += src.decompress_ms;
+    dest.composite_ms += src.composite_ms;
+    dest.prefetch_ms += src.prefetch_ms;
+    dest.blocks += src.blocks;
+    dest.cache_hits += src.cache_hits;
+    dest.uncompressed_hits += src.uncompressed_hits;
+    dest.blocks_fetched += src.blocks_fetched;
+    dest.blocks_synthesized += src.blocks_synthesized;
+    dest.empty_blocks += src.empty_blocks;
+    dest.bytes_fetched += src.bytes_fetched;
+    dest.prefetch = dest.prefetch || src.prefetch;
+}
+
+void ImageService::retrieve_image_progressive(unsigned int width, unsigned int height,
+        vector<int> offset, const ImageSurface& surface, int zoom, ProgressCallback callback)
+{
+    ImageSurface resolved = resolve_surface(surface, width, config.bytedepth);
     vector<double> dim1step, dim2step;
-    _retrieve_image_fovea(width, height, offset, buffer, zoom, centercut, dim1step, dim2step); 
+
+    cancel_progressive();
+    progressive_thread = shared_ptr<boost::thread>(new boost::thread([=]() {
+        _retrieve_progressive(width, height, offset, resolved, zoom, dim1step, dim2step, callback);
+    }));
+}
+
+void ImageService::retrieve_arbimage_progressive(unsigned int width, unsigned int height,
+        vector<int> centerloc, vector<double> dim1vec, vector<double> dim2vec,
+        const ImageSurface& surface, int zoom, ProgressCallback callback)
+{
+    ImageSurface resolved = resolve_surface(surface, width, config.bytedepth);
+    vector<int> offset;
+    vector<double> dim1step, dim2step;
+    arb_plane(width, height, centerloc, dim1vec, dim2vec, zoom, offset, dim1step, dim2step);
+
+    cancel_progressive();
+    progressive_thread = shared_ptr<boost::thread>(new boost::thread([=]() {
+        _retrieve_progressive(width, height, offset, resolved, zoom, dim1step, dim2step, callback);
+    }));
+}
+
+void ImageService::cancel_progressive()
+{
+    if (!progressive_thread) {
+        return;
+    }
+    if (progressive_thread->get_id() == boost::this_thread::get_id()) {
+        throw LowtisErr("Progressive request cannot be changed from its callback");
+    }
+    progressive_cancel = true;
+    progressive_thread->join();
+    progressive_thread.reset();
+    progressive_cancel = false;
+}
+
+// surface is resolved by the caller
+void ImageService::_retrieve_progressive(unsigned int width, unsigned int height,
+        vector<int> offset, ImageSurface surface, int zoom, vector<double> dim1step,
+        vector<double> dim2step, ProgressCallback callback)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    RetrieveReport call_report;
+    ProgressUpdate update;
+
+    try {
+        // finest coarser level that is cached, otherwise the coarsest one
+        // (nothing to do if the requested level is cached); the fetchers
+        // are shared with foreground requests
+        int coarse = zoom;
+        size_t num_blocks = 0;
+        {
+            std::lock_guard<std::mutex> lock(gmutex);
+            if (missing_fraction(width, height, offset, zoom, fetcher, dim1step, dim2step,
+                        num_blocks) > 0) {
+                for (int level = zoom + 1; level <= zoom + int(config.progressive_levels); ++level) {
+                    unsigned int lowwidth = width >> (level - zoom);
+                    unsigned int lowheight = height >> (level - zoom);
+                    if ((lowwidth == 0) || (lowheight == 0) || !fetcher2->has_zoom(level)) {
+                        break;
+                    }
+                    coarse = level;
+                    if (missing_fraction(lowwidth, lowheight, offset, level, fetcher2,
+                                dim1step, dim2step, num_blocks) == 0) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        // fill the whole image from the coarse level
+        if (coarse > zoom) {
+            int lowshift = coarse - zoom;
+            unsigned int lowwidth = width >> lowshift;
+            unsigned int lowheight = height >> lowshift;
+            vector<char> lowbuffer(lowwidth*lowheight*config.bytedepth);
+            ImageSurface lowsurface;
+            lowsurface.buffer = &lowbuffer[0];
+            lowsurface = resolve_surface(lowsurface, lowwidth, config.bytedepth);
+
+            RetrieveReport pass_report;
+            {
+                std::lock_guard<std::mutex> lock(gmutex);
+                validate_cache();
+                _retrieve_image(lowwidth, lowheight, offset, lowsurface, coarse, fetcher2,
+                        dim1step, dim2step, &pass_report);
+            }
+            merge_report(call_report, pass_report);
+
+            if (!progressive_cancel) {
+                upsample_pixels(&lowbuffer[0], lowwidth, lowheight, lowshift, config.bytedepth,
+                        surface, 0, 0, 0, 0);
+                DirtyRect rect;
+                rect.width = lowwidth << lowshift;
+                rect.height = lowheight << lowshift;
+                rect.zoom = coarse;
+                update.rects.push_back(rect);
+                callback(update);
+            }
+        }
+
+        // refine the image one region at a time from the center outwards
+        unsigned int tilesize = config.progressive_tile_size;
+        unsigned int tilewidth = (tilesize > 0) ? tilesize : width;
+        unsigned int tileheight = (tilesize > 0) ? tilesize : height;
+        vector<DirtyRect> tiles;
+        for (unsigned int y = 0; y < height; y += tileheight) {
+            for (unsigned int x = 0; x < width; x += tilewidth) {
+                DirtyRect tile;
+                tile.x = x;
+                tile.y = y;
+                tile.width = std::min(tilewidth, width - x);
+                tile.height = std::min(tileheight, height - y);
+                tile.zoom = zoom;
+                tiles.push_back(tile);
+            }
+        }
+        std::stable_sort(tiles.begin(), tiles.end(), [&](const DirtyRect& a, const DirtyRect& b) {
+            double ax = a.x + a.width/2.0 - width/2.0, ay = a.y + a.height/2.0 - height/2.0;
+            double bx = b.x + b.width/2.0 - width/2.0, by = b.y + b.height/2.0 - height/2.0;
+            return (ax*ax + ay*ay) < (bx*bx + by*by);
+        });
+
+        update.rects.clear();
+        for (size_t i = 0; i < tiles.size() && !progressive_cancel; ++i) {
+            const DirtyRect& tile = tiles[i];
+
+            // tile offset in global coordinates
+            vector<int> tileoffset = offset;
+            int offset0 = tile.x;
+            int offset1 = tile.y;
+            for (int j = 0; j < zoom; ++j) {
+                offset0 *= 2;
+                offset1 *= 2;
+            }
+            if (!dim1step.empty()) {
+                vector<double> dummyvec(3,0);
+                increment_vector(tileoffset, dim1step, dim2step, dummyvec, offset0, offset1, 0); 
+            } else {
+                tileoffset[0] += offset0;
+                tileoffset[1] += offset1;
+            }
+
+            ImageSurface tilesurface = surface;
+            tilesurface.xoffset += tile.x;
+            tilesurface.yoffset += tile.y;
+
+            RetrieveReport pass_report;
+            {
+                std::lock_guard<std::mutex> lock(gmutex);
+                validate_cache();
+                _retrieve_image(tile.width, tile.height, tileoffset, tilesurface, zoom, fetcher,
+                        dim1step, dim2step, &pass_report);
+            }
+            merge_report(call_report, pass_report);
+
+            // the last region is sent with done
+            update.rects.assign(1, tile);
+            if ((i + 1 < tiles.size()) && !progressive_cancel) {
+                callback(update);
+            }
+        }
+    } catch (std::exception& e) {
+        ProgressUpdate failed;
+        failed.done = true;
+        failed.error = e.what();
+        callback(failed);
+        return;
+    }
+
+    call_report.total_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start_time).count();
+    update_stats(call_report);
+
+    if (!progressive_cancel) {
+        update.done = true;
+        callback(update);
+    }
 }
 
+// surface is resolved by the caller
 void ImageService::_retrieve_image_fovea(unsigned int width,
-        unsigned int height, vector<int> offset, char* buffer, int zoom, bool centercut, vector<double> dim1step, vector<double> dim2step)
+        unsigned int height, vector<int> offset, ImageSurface surface, int zoom, bool centercut, vector<double> dim1step, vector<double> dim2step,
+        RetrieveReport* report)
 {
     unsigned int cwidth = 0;
     unsigned int cheight = 0; 
+    int lowzoom = zoom + 1;
+
+    // planning probes the caches and fetchers used by the passes
+    std::unique_lock<std::mutex> lock(gmutex);
+    validate_cache();
 
     if (centercut) {
         // retrieve high-resolution center
         cwidth = get<0>(config.centercut);
-        cheight = get<0>(config.centercut);
+        cheight = get<1>(config.centercut);
+        if (config.fovea_target_ms > 0) {
+            plan_fovea(width, height, offset, zoom, dim1step, dim2step,
+                    centercut, cwidth, cheight, lowzoom);
+        }
 
         // if either dimension is smaller than the center cut, disable centercut
         if ((cwidth >= width) || (cheight >= height)) {
@@ -189,18 +1376,25 @@ void ImageService::_retrieve_image_fovea(unsigned int width,
     }
 
     if (!centercut) {
-        gmutex.lock();
-        _retrieve_image(width, height, offset, buffer, zoom, fetcher, dim1step, dim2step);
-        gmutex.unlock();
+        _retrieve_image(width, height, offset, surface, zoom, fetcher, dim1step, dim2step, report);
     } else {
         // call as boost threads and join
         boost::thread_group threads;
 
-        char *buffer2 = new char[cwidth*cheight*config.bytedepth];
+        // the high-resolution center is written directly into the surface
+        ImageSurface centersurface = surface;
+        centersurface.xoffset += (width-cwidth)/2;
+        centersurface.yoffset += (height-cheight)/2;
  
-        // retrieve 1/4 image at lower resolution
+        // retrieve image at lower resolution (1/4 size for one zoom level)
         // !! this requires the caller to avoid using the fovia if at the lowest resolution already
-        char *buffer3 = new char[width/2*height/2*config.bytedepth];
+        int lowshift = lowzoom - zoom;
+        unsigned int lowwidth = width >> lowshift;
+        unsigned int lowheight = height >> lowshift;
+        char *buffer3 = new char[lowwidth*lowheight*config.bytedepth];
+        ImageSurface lowressurface;
+        lowressurface.buffer = buffer3;
+        lowressurface = resolve_surface(lowressurface, lowwidth, config.bytedepth);
 
         // make new offset for small window
         vector<int> tempoffset = offset;
@@ -219,141 +1413,140 @@ void ImageService::_retrieve_image_fovea(unsigned int width,
             tempoffset[1] += offset1;
         }
 
-        gmutex.lock();
-        boost::thread* t1 = new boost::thread(&ImageService::_retrieve_image, this, cwidth, cheight, tempoffset, buffer2, zoom, fetcher, dim1step, dim2step);
+        RetrieveReport center_report, lowres_report;
+        boost::thread* t1 = new boost::thread([&]() {
+            _retrieve_image(cwidth, cheight, tempoffset, centersurface, zoom, fetcher, dim1step, dim2step, &center_report);
+        });
         threads.add_thread(t1);
 
-        boost::thread* t2 = new boost::thread(&ImageService::_retrieve_image, this, width/2, height/2, offset, buffer3, zoom+1, fetcher2, dim1step, dim2step);
-        //_retrieve_image(width/2, height/2, offset, buffer3, zoom+1, fetcher2);
+        boost::thread* t2 = new boost::thread([&]() {
+            _retrieve_image(lowwidth, lowheight, offset, lowressurface, lowzoom, fetcher2, dim1step, dim2step, &lowres_report);
+        });
         threads.add_thread(t2);
        
         // wait for results 
         threads.join_all();
-        gmutex.unlock();
+        lock.unlock();
+
+        report->fovea = true;
+        merge_report(*report, center_report);
+        merge_report(*report, lowres_report);
        
-        // set buffers
-        // write low resolution version into buffer
-        char * bufferiter = buffer;
-        char * bufferiter2 = buffer;
-        char* buffer3_iter = buffer3;
-        for (int j = 0; j < height/2; j++) {
-            char * bufferiter = buffer + (2*j*width*config.bytedepth);
-            char * bufferiter2 = bufferiter + (width*config.bytedepth);
-            for (int i = 0; i < width/2; i++) {
-                for (int iter = 0; iter < config.bytedepth; iter++) {
-                    // write into four spots (simple downsample)
-                    *bufferiter = *buffer3_iter;
-                    bufferiter[config.bytedepth] = *buffer3_iter;
-                    ++bufferiter;
-
-                    *bufferiter2 = *buffer3_iter;
-                    bufferiter2[config.bytedepth] = *buffer3_iter;
-                    ++bufferiter2;
-
-                    ++buffer3_iter;
-                }
-                bufferiter += (config.bytedepth);
-                bufferiter2 += (config.bytedepth);
-            }
-        } 
-        
-        // write center cut
-        char* buffer2_iter = buffer2;
-        for (int j = 0; j < cheight; ++j) {
-            char * bufferiter = buffer + ((j+(height-cheight)/2)*width*config.bytedepth) + (width-cwidth)/2*config.bytedepth;
-            for (int i = 0; i < cwidth; ++i) {
-                for (int iter = 0; iter < config.bytedepth; iter++) {
-                    *bufferiter = *buffer2_iter;
-                    
-                    ++buffer2_iter;
-                    ++bufferiter;
-                }
-            }
-        }
+        // write low resolution version around the center cut
+        upsample_pixels(buffer3, lowwidth, lowheight, lowshift, config.bytedepth, surface,
+                (width-cwidth)/2, (height-cheight)/2, cwidth, cheight);
 
         // TODO: keep a memory buffer to avoid reallocation (already know centercut size)
-        delete []buffer2;
         delete []buffer3;
     }
 }
 
-void ImageService::_retrieve_image(unsigned int width,
-        unsigned int height, vector<int> offset, char* buffer, int zoom, shared_ptr<BlockFetch> curr_fetcher, vector<double> dim1step, vector<double> dim2step)
+void ImageService::_load_blocks(vector<Block>& blocks, int zoom,
+        shared_ptr<BlockFetch> curr_fetcher, shared_ptr<BlockCache> curr_cache,
+        shared_ptr<BlockCache> curr_uncompressed_cache, RetrieveReport* report)
 {
-    auto initial_time = std::chrono::high_resolution_clock::now(); 
-    // adjust offset for zoom
-    for (int i = 0; i < zoom; i++) {
-        offset[0] /= 2;
-        offset[1] /= 2;
-        offset[2] /= 2;
-    }
-
-    // find intersecting blocks
-    // TODO: make 2D call instead (remove dims and say dim1, dim2)
-    vector<unsigned int> dims;
-    dims.push_back(width);
-    dims.push_back(height);
-    dims.push_back(1);
-
     auto start_cache_time = std::chrono::high_resolution_clock::now();
-    vector<double> dim3step(3, 0); // only will work on a dim1, dim2 
-    vector<DVIDCompressedBlock> blocks = curr_fetcher->intersecting_blocks(dims, offset, dim1step, dim2step, dim3step);
+
     // check cache and save missing blocks
-    vector<DVIDCompressedBlock> current_blocks;
-    vector<DVIDCompressedBlock> missing_blocks;
+    vector<Block> current_blocks;
+    vector<Block> missing_blocks;
+
+    // reused blocks from a slow codec are re-encoded when idle
+    DVIDCompressedBlock::CompressType ctype = curr_fetcher->get_compression_type();
+    // (re-encoded lz4 blocks are decoded by libdvid, which needs cubes)
+    bool transcode = transcoder && (curr_cache == cache) && curr_fetcher->cubic_blocks() &&
+        ((ctype == DVIDCompressedBlock::gzip_labelarray) || (ctype == DVIDCompressedBlock::jpeg));
 
     for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
-        BlockCoords coords;
-        const vector<int>& toffset = iter->get_offset();
-        coords.x = toffset[0];
-        coords.y = toffset[1];
-        coords.z = toffset[2];
-        coords.zoom = zoom;
-        
-        DVIDCompressedBlock block = *iter;
-        bool found = cache->retrieve_block(coords, block);
+        Block block;
+        bool transcoded = false;
+        bool found = curr_cache->retrieve_block(iter->get_coords(), block, &transcoded);
         if (found) {
-            current_blocks.push_back(block);
+            if (transcode && !transcoded) {
+                transcoder->add_block(block);
+            }
+            current_blocks.push_back(std::move(block));
         } else {
-            missing_blocks.push_back(block);
+            missing_blocks.push_back(std::move(*iter));
         }
     }
+    size_t num_blocks = blocks.size();
+    blocks.clear();
+
+    size_t cache_hits = current_blocks.size();
+    report->blocks += num_blocks;
+    report->cache_hits += cache_hits;
 
     auto end_cache_time = std::chrono::high_resolution_clock::now();
     //std::cout << "cache time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_cache_time - start_cache_time).count() << " milliseconds" << std::endl;
+    report->cache_ms += elapsed_ms(start_cache_time, end_cache_time);
 
     // fetch data    
     auto start_fetch_time = std::chrono::high_resolution_clock::now(); 
     
-    // call interface for blocks desired 
-    curr_fetcher->extract_specific_blocks(missing_blocks, zoom);
+    // call interface for blocks desired (or build them from finer levels)
+    if ((zoom > 0) && (config.synthesize_zoom_levels > 0) && !curr_fetcher->has_zoom(zoom)) {
+        _synthesize_blocks(missing_blocks, zoom, curr_fetcher, config.synthesize_zoom_levels);
+        report->blocks_synthesized += missing_blocks.size();
+
+        // add missing blocks to regular cache 
+        for (auto iter = missing_blocks.begin(); iter != missing_blocks.end(); ++iter) {
+            curr_cache->set_block(*iter);
+        }
+    } else {
+        // cache and decode blocks as they arrive
+        size_t num_requested = missing_blocks.size();
+        vector<Block> fetched_blocks;
+        std::unique_ptr<StreamDecoder> decoder;
+        if (curr_uncompressed_cache && !missing_blocks.empty()) {
+            decoder.reset(new StreamDecoder(num_worker_threads(), curr_uncompressed_cache,
+                        curr_fetcher.get()));
+        }
+        curr_fetcher->stream_blocks(missing_blocks, zoom, [&](Block& block) {
+            if (block.get_data()) {
+                ++(report->blocks_fetched);
+                report->bytes_fetched += block.get_datasize();
+            }
+            curr_cache->set_block(block);
+            if (decoder) {
+                decoder->add_block(block);
+            }
+            fetched_blocks.push_back(std::move(block));
+        });
+        if (decoder) {
+            decoder->finish();
+        }
+        missing_blocks.swap(fetched_blocks);
+        fetch_model->add_sample(num_requested, elapsed_ms(start_fetch_time,
+                    std::chrono::high_resolution_clock::now()));
+    }
     
     auto end_fetch_time = std::chrono::high_resolution_clock::now(); 
     //std::cout << "fetch time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_fetch_time-start_fetch_time).count() << " milliseconds" << std::endl;
+    report->fetch_ms += elapsed_ms(start_fetch_time, end_fetch_time);
 
-    current_blocks.insert(current_blocks.end(), missing_blocks.begin(), 
-            missing_blocks.end());
+    current_blocks.insert(current_blocks.end(), std::make_move_iterator(missing_blocks.begin()),
+            std::make_move_iterator(missing_blocks.end()));
 
-    // add missing blocks to regular cache 
-    for (auto iter = missing_blocks.begin(); iter != missing_blocks.end(); ++iter) {
-        cache->set_block(*iter, zoom);
+    for (auto iter = current_blocks.begin(); iter != current_blocks.end(); ++iter) {
+        if (!iter->get_data()) {
+            ++(report->empty_blocks);
+        }
     }
 
     // decompress blocks if necessary
-    if (uncompressed_cache) { 
+    if (curr_uncompressed_cache) { 
         auto ct1 = std::chrono::high_resolution_clock::now(); 
 
         boost::thread_group threads; // destructor auto deletes threads
-        int num_threads = std::thread::hardware_concurrency();
-        if (num_threads == 0) {
-            // just default to something if hardware concurrency not supported
-            num_threads = 8;
-        }
-        
+        int num_threads = num_worker_threads();
+        std::atomic<unsigned int> uncompressed_hits(0);
+
 
         vector<boost::thread*> curr_threads;  
         for (int i = 0; i < num_threads; ++i) {
-            boost::thread* t = new boost::thread(decompress_block, &current_blocks, i, num_threads, zoom, uncompressed_cache);
+            boost::thread* t = new boost::thread(decompress_block, &current_blocks, i, num_threads, curr_uncompressed_cache,
+                    curr_fetcher.get(), cache_hits, &uncompressed_hits);
             threads.add_thread(t);
             curr_threads.push_back(t);
         } 
@@ -361,155 +1554,292 @@ void ImageService::_retrieve_image(unsigned int width,
         
         auto ct2 = std::chrono::high_resolution_clock::now(); 
         //std::cout << "decompress: " << std::chrono::duration_cast<std::chrono::milliseconds>(ct2-ct1).count() << " milliseconds" << std::endl;
+        report->decompress_ms += elapsed_ms(ct1, ct2);
+        report->uncompressed_hits += uncompressed_hits;
     }
-    
-    // TODO: better arbitrary cut interpolation (ideally would also change intersection algorithm)
-    auto start_compute_intersection_time = std::chrono::high_resolution_clock::now();
-    if (!dim1step.empty()) {
-        // create lookup map for blocks
-        unordered_map<BlockCoords, const unsigned char* > mappedblocks;
-        for (auto iter = current_blocks.begin(); iter != current_blocks.end(); ++iter) {
-            const vector<int>& toffset = iter->get_offset();
-            BlockCoords coords;
-            coords.x = toffset[0];
-            coords.y = toffset[1];
-            coords.z = toffset[2];
-            if (iter->get_data()) {
-                mappedblocks[coords] = iter->get_uncompressed_data()->get_raw();
-            } else {
-                mappedblocks[coords] = 0;
-            }
+
+    blocks.swap(current_blocks);
+}
+
+void ImageService::_retrieve_stack(unsigned int width, unsigned int height,
+        unsigned int depth, vector<int> offset, char* buffer, int zoom,
+        vector<double> dim1step, vector<double> dim2step, RetrieveReport* report)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    RetrieveReport call_report;
+
+    if ((width > 0) && (height > 0) && (depth > 0)) {
+        std::lock_guard<std::mutex> lock(gmutex);
+        TranscodePause transcode_pause(transcoder);
+        validate_cache();
+
+        // adjust offset for zoom
+        for (int i = 0; i < zoom; i++) {
+            offset[0] /= 2;
+            offset[1] /= 2;
+            offset[2] /= 2;
         }
 
-        // !! assume uniform blocks
-        size_t isoblksize = current_blocks[0].get_blocksize();
-       
-        // set default value for image 
-        assert((config.emptyval == 0) || (config.bytedepth == 1));
-        memset(buffer, config.emptyval, width*height*config.bytedepth);
-        
-        vector<double> toffset(3);
-        toffset[0] = offset[0];
-        toffset[1] = offset[1];
-        toffset[2] = offset[2];
-
-        const unsigned char* raw_data = nullptr;
-        BlockCoords pre_coords;
-        pre_coords.x = INT32_MIN;
-        pre_coords.y = INT32_MIN;
-        pre_coords.z = INT32_MIN;
-
-        for (int dim2 = 0; dim2 < height; ++dim2) {
-            for (int dim1 = 0; dim1 < width; ++dim1) {
-                // grab block address
-                int x = static_cast<int>(toffset[0] + 0.5);
-                int y = static_cast<int>(toffset[1] + 0.5);
-                int z = static_cast<int>(toffset[2] + 0.5);
-                // find offset within block
-                int xshift = x % isoblksize;
-                int yshift = y % isoblksize;
-                int zshift = z % isoblksize;
-
-                BlockCoords coords;
-                coords.x = x - xshift;
-                coords.y = y - yshift;
-                coords.z = z - zshift;
-
-                if (!(pre_coords == coords))
-                {
-                    raw_data = mappedblocks[coords];
-                    pre_coords = coords;
-                }
+        // planes are stacked along the normal of arbitrary planes
+        vector<double> dim3step(3, 0);
+        if (!dim1step.empty()) {
+            dim3step[0] = dim1step[1]*dim2step[2] - dim1step[2]*dim2step[1];
+            dim3step[1] = dim1step[2]*dim2step[0] - dim1step[0]*dim2step[2];
+            dim3step[2] = dim1step[0]*dim2step[1] - dim1step[1]*dim2step[0];
+        }
 
-                // don't write data if empty
-                if (raw_data) {
-                    const unsigned char*  raw_data_local = raw_data +(zshift*(isoblksize*isoblksize) + yshift*isoblksize + xshift)*config.bytedepth;
+        vector<unsigned int> dims;
+        dims.push_back(width);
+        dims.push_back(height);
+        dims.push_back(depth);
+        vector<Block> blocks = fetcher->intersecting_blocks(dims, offset,
+                dim1step, dim2step, dim3step, zoom);
+        _load_blocks(blocks, zoom, fetcher, cache, uncompressed_cache, &call_report);
+
+        auto start_composite_time = std::chrono::high_resolution_clock::now();
 
-                    for (int bytepos = 0; bytepos < config.bytedepth; ++bytepos) {
-                        *buffer = *raw_data_local;
+        // value written for pixels without data (emptyval in the lowest byte)
+        vector<unsigned char> emptypixel(config.bytedepth, 0);
+        emptypixel[0] = config.emptyval;
 
-                        // write buffer in order
-                        ++raw_data_local;
-                        ++buffer;
+        ImageSurface surface;
+        surface.buffer = buffer;
+        surface = resolve_surface(surface, width, config.bytedepth);
+        size_t planestride = size_t(height)*surface.rowstride;
+
+        // blocks (orthogonal) or planes (arbitrary) are split between threads
+        boost::thread_group threads; // destructor auto deletes threads
+        int num_threads = num_worker_threads();
+        MappedBlocks mappedblocks;
+        if (dim1step.empty()) {
+            for (int i = 0; i < num_threads; ++i) {
+                threads.add_thread(new boost::thread([&, i]() {
+                    for (size_t id = i; id < blocks.size(); id += num_threads) {
+                        composite_block(blocks[id], fetcher.get(), offset, width, height, depth,
+                                &emptypixel[0], config.bytedepth, surface, planestride);
                     }
-                } else {
-                    buffer += config.bytedepth;
-                }
+                }));
+            }
+        } else {
+            map_blocks(blocks, fetcher.get(), num_threads, mappedblocks);
+            for (int i = 0; i < num_threads; ++i) {
+                threads.add_thread(new boost::thread([&, i]() {
+                    for (unsigned int plane = i; plane < depth; plane += num_threads) {
+                        ImageSurface planesurface = surface;
+                        planesurface.buffer += plane*planestride;
+                        for (unsigned int row = 0; row < height; ++row) {
+                            fill_pixels(surface_row(planesurface, row), width, &emptypixel[0],
+                                    planesurface.pixeldepth);
+                        }
+                        vector<double> toffset(3);
+                        for (int j = 0; j < 3; ++j) {
+                            toffset[j] = offset[j] + dim3step[j]*plane;
+                        }
+                        sample_plane(mappedblocks, toffset, dim1step, dim2step, width, height,
+                                fetcher->get_blocksize(), config.bytedepth, planesurface);
+                    }
+                }));
+            }
+        }
+        threads.join_all();
+
+        call_report.composite_ms += elapsed_ms(start_composite_time,
+                std::chrono::high_resolution_clock::now());
+    }
 
-                toffset[0] += dim1step[0];
-                toffset[1] += dim1step[1];
-                toffset[2] += dim1step[2];
+    call_report.total_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start_time).count();
+    update_stats(call_report);
+    if (report) {
+        *report = call_report;
+    }
+}
+
+void ImageService::retrieve_views(const vector<ViewSpec>& views, RetrieveReport* report)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    RetrieveReport call_report;
+
+    {
+        std::lock_guard<std::mutex> lock(gmutex);
+        TranscodePause transcode_pause(transcoder);
+        validate_cache();
+
+        // planes, surfaces and blocks of each view (in the coordinates of its zoom)
+        size_t num_views = views.size();
+        vector<vector<int> > offsets(num_views);
+        vector<vector<double> > dim1steps(num_views), dim2steps(num_views);
+        vector<ImageSurface> surfaces(num_views);
+        vector<vector<BlockCoords> > viewblocks(num_views);
+
+        // union of the blocks of each zoom level
+        std::map<int, vector<Block> > zoomblocks;
+        std::map<int, unordered_map<BlockCoords, size_t> > zoomindex;
+
+        for (size_t v = 0; v < num_views; ++v) {
+            const ViewSpec& view = views[v];
+            if (!view.dim1vec.empty()) {
+                arb_plane(view.width, view.height, view.location, view.dim1vec, view.dim2vec,
+                        view.zoom, offsets[v], dim1steps[v], dim2steps[v]);
+            } else {
+                offsets[v] = view.location;
+            }
+            surfaces[v] = resolve_surface(view.surface, view.width, config.bytedepth);
+
+            // adjust offset for zoom
+            for (int i = 0; i < view.zoom; i++) {
+                offsets[v][0] /= 2;
+                offsets[v][1] /= 2;
+                offsets[v][2] /= 2;
             }
-            toffset[0] -= (width*dim1step[0]);
-            toffset[1] -= (width*dim1step[1]);
-            toffset[2] -= (width*dim1step[2]);
 
-            toffset[0] += (dim2step[0]);
-            toffset[1] += (dim2step[1]);
-            toffset[2] += (dim2step[2]);
+            vector<unsigned int> dims;
+            dims.push_back(view.width);
+            dims.push_back(view.height);
+            dims.push_back(1);
+            vector<double> dim3step(3, 0);
+            vector<Block> blocks = fetcher->intersecting_blocks(dims, offsets[v],
+                    dim1steps[v], dim2steps[v], dim3step, view.zoom);
+
+            vector<Block>& unionblocks = zoomblocks[view.zoom];
+            unordered_map<BlockCoords, size_t>& index = zoomindex[view.zoom];
+            for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+                BlockCoords coords = iter->get_coords();
+                if (index.find(coords) == index.end()) {
+                    index[coords] = unionblocks.size();
+                    unionblocks.push_back(std::move(*iter));
+                }
+                viewblocks[v].push_back(coords);
+            }
         }
-    } else {
-        // populate image from blocks and return data
-        for (auto iter = current_blocks.begin(); iter != current_blocks.end(); ++iter) {
-            bool emptyblock = false;
-            if (!(iter->get_data())) {
-                emptyblock = true;
+
+        // load and decode each block once
+        int num_threads = num_worker_threads();
+        std::map<int, MappedBlocks> zoommapped;
+        for (auto iter = zoomblocks.begin(); iter != zoomblocks.end(); ++iter) {
+            vector<Block>& blocks = iter->second;
+            _load_blocks(blocks, iter->first, fetcher, cache, uncompressed_cache, &call_report);
+            if (!uncompressed_cache) {
+                auto ct1 = std::chrono::high_resolution_clock::now();
+                decode_blocks(blocks, fetcher.get(), num_threads);
+                call_report.decompress_ms += elapsed_ms(ct1, std::chrono::high_resolution_clock::now());
             }
+            map_blocks(blocks, fetcher.get(), 1, zoommapped[iter->first]);
 
-            size_t blocksize = iter->get_blocksize();
+            // loaded blocks are in a different order
+            unordered_map<BlockCoords, size_t>& index = zoomindex[iter->first];
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                index[blocks[i].get_coords()] = i;
+            }
+        }
 
-            const unsigned char* raw_data = 0;
+        auto start_composite_time = std::chrono::high_resolution_clock::now();
 
-            BinaryDataPtr raw_data_ptr;
-            if (!emptyblock) {
-                raw_data_ptr = iter->get_uncompressed_data();
-                raw_data = raw_data_ptr->get_raw();
-                if (raw_data_ptr->length() < blocksize * blocksize * blocksize) {
-                    emptyblock = true;
+        // value written for pixels without data (emptyval in the lowest byte)
+        vector<unsigned char> emptypixel(config.bytedepth, 0);
+        emptypixel[0] = config.emptyval;
+
+        // each view is written by its own thread
+        boost::thread_group threads; // destructor auto deletes threads
+        for (size_t v = 0; v < num_views; ++v) {
+            threads.add_thread(new boost::thread([&, v]() {
+                const ViewSpec& view = views[v];
+                if (!dim1steps[v].empty()) {
+                    for (unsigned int row = 0; row < view.height; ++row) {
+                        fill_pixels(surface_row(surfaces[v], row), view.width, &emptypixel[0],
+                                surfaces[v].pixeldepth);
+                    }
+                    vector<double> toffset(offsets[v].begin(), offsets[v].end());
+                    sample_plane(zoommapped.at(view.zoom), toffset, dim1steps[v], dim2steps[v],
+                            view.width, view.height, fetcher->get_blocksize(), config.bytedepth,
+                            surfaces[v]);
+                } else {
+                    const vector<Block>& blocks = zoomblocks.at(view.zoom);
+                    const unordered_map<BlockCoords, size_t>& index = zoomindex.at(view.zoom);
+                    for (auto iter = viewblocks[v].begin(); iter != viewblocks[v].end(); ++iter) {
+                        composite_block(blocks[index.find(*iter)->second], fetcher.get(),
+                                offsets[v], view.width, view.height, 1, &emptypixel[0],
+                                config.bytedepth, surfaces[v], 0);
+                    }
                 }
-            }
+            }));
+        }
+        threads.join_all();
 
-            // extract common dim3 offset (will refer to as 'z')
-            vector<int> toffset = iter->get_offset();
-            int zoff = offset[2] - toffset[2];
+        call_report.composite_ms += elapsed_ms(start_composite_time,
+                std::chrono::high_resolution_clock::now());
+    }
 
-            // find intersection between block and buffer
-            int startx = std::max(offset[0], toffset[0]);
-            int finishx = std::min(offset[0]+int(width), toffset[0]+int(blocksize));
-            int starty = std::max(offset[1], toffset[1]);
-            int finishy = std::min(offset[1]+int(height), toffset[1]+int(blocksize));
+    call_report.total_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start_time).count();
+    update_stats(call_report);
+    if (report) {
+        *report = call_report;
+    }
+}
 
-            unsigned long long iterpos = zoff * blocksize * blocksize * config.bytedepth;
+// surface is resolved by the caller
+void ImageService::_retrieve_image(unsigned int width,
+        unsigned int height, vector<int> offset, ImageSurface surface, int zoom, shared_ptr<BlockFetch> curr_fetcher, vector<double> dim1step, vector<double> dim2step,
+        RetrieveReport* report)
+{
+    auto initial_time = std::chrono::high_resolution_clock::now(); 
+    TranscodePause transcode_pause(transcoder);
 
-            // point to correct plane
-            raw_data += iterpos;
+    // orthogonal views are built from 2D tiles when available
+    // (prefetch keeps using 3D blocks)
+    shared_ptr<BlockFetch> block_fetcher = curr_fetcher;
+    shared_ptr<BlockCache> curr_cache = cache;
+    shared_ptr<BlockCache> curr_uncompressed_cache = uncompressed_cache;
+    select_tiles(curr_fetcher, curr_cache, curr_uncompressed_cache, zoom, dim1step);
 
-            // point to correct y,x
-            raw_data += (((starty-toffset[1])*blocksize*config.bytedepth) + 
-                    ((startx-toffset[0])*config.bytedepth)); 
-            char* bytebuffer_temp = buffer + ((starty-offset[1])*width*config.bytedepth) +
-                ((startx-offset[0])*config.bytedepth); 
+    // adjust offset for zoom
+    for (int i = 0; i < zoom; i++) {
+        offset[0] /= 2;
+        offset[1] /= 2;
+        offset[2] /= 2;
+    }
 
-            for (int ypos = starty; ypos < finishy; ++ypos) {
-                for (int xpos = startx; xpos < finishx; ++xpos) {
-                    for (int bytepos = 0; bytepos < config.bytedepth; ++bytepos) {
-                        if (!emptyblock) {
-                            *bytebuffer_temp = *raw_data;
-                        } else {
-                            // TODO: properly set for entire bytedepth
-                            *bytebuffer_temp = config.emptyval;
-                        }
-                        ++raw_data;
-                        ++bytebuffer_temp;
-                    } 
-                }
-                raw_data += (blocksize-(finishx-startx))*config.bytedepth;
-                bytebuffer_temp += (width-(finishx-startx))*config.bytedepth;
-            }
+    // find intersecting blocks
+    // TODO: make 2D call instead (remove dims and say dim1, dim2)
+    vector<unsigned int> dims;
+    dims.push_back(width);
+    dims.push_back(height);
+    dims.push_back(1);
+
+    vector<double> dim3step(3, 0); // only will work on a dim1, dim2 
+    vector<Block> current_blocks = curr_fetcher->intersecting_blocks(dims, offset, dim1step, dim2step, dim3step, zoom);
+    _load_blocks(current_blocks, zoom, curr_fetcher, curr_cache, curr_uncompressed_cache, report);
+
+    // value written for pixels without data (emptyval in the lowest byte)
+    vector<unsigned char> emptypixel(config.bytedepth, 0);
+    emptypixel[0] = config.emptyval;
+
+    // TODO: better arbitrary cut interpolation (ideally would also change intersection algorithm)
+    auto start_compute_intersection_time = std::chrono::high_resolution_clock::now();
+    if (!dim1step.empty()) {
+        // create lookup map for blocks (keep decoded data alive while writing)
+        MappedBlocks mappedblocks;
+        map_blocks(current_blocks, curr_fetcher.get(), 1, mappedblocks);
+       
+        // set default value for image 
+        for (unsigned int row = 0; row < height; ++row) {
+            fill_pixels(surface_row(surface, row), width, &emptypixel[0], surface.pixeldepth);
+        }
+        
+        vector<double> toffset(offset.begin(), offset.end());
+        sample_plane(mappedblocks, toffset, dim1step, dim2step, width, height,
+                curr_fetcher->get_blocksize(), config.bytedepth, surface);
+    } else {
+        // populate image from blocks and return data
+        for (auto iter = current_blocks.begin(); iter != current_blocks.end(); ++iter) {
+            composite_block(*iter, curr_fetcher.get(), offset, width, height, 1,
+                    &emptypixel[0], config.bytedepth, surface, 0);
         }
     }
     auto end_compute_intersection_time = std::chrono::high_resolution_clock::now();
     //std::cout << "compute intersection time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_compute_intersection_time - start_compute_intersection_time).count() << " milliseconds" << std::endl;
+    report->composite_ms += elapsed_ms(start_compute_intersection_time, end_compute_intersection_time);
    
     // perform non-blocking prefetch
     // depending on the block fetcher this will be either a non-opt,
@@ -548,38 +1878,97 @@ void ImageService::_retrieve_image(unsigned int width,
         dims.push_back(newheight);
         dims.push_back(newdepth);
 
-        vector<DVIDCompressedBlock> blocks = curr_fetcher->intersecting_blocks(dims, newoffset, dim1step, dim2step, dim3step);
+        vector<Block> blocks = block_fetcher->intersecting_blocks(dims, newoffset, dim1step, dim2step, dim3step, zoom);
 
         // check cache and save missing blocks
-        vector<DVIDCompressedBlock> missing_blocks;
+        vector<Block> missing_blocks;
 
         // only prefetch missing blocks
+        Block block;
         for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
-            BlockCoords coords;
-            vector<int> toffset = iter->get_offset();
-            coords.x = toffset[0];
-            coords.y = toffset[1];
-            coords.z = toffset[2];
-            coords.zoom = zoom;
-
-            DVIDCompressedBlock block = *iter;
-            bool found = cache->retrieve_block(coords, block);
+            bool found = cache->retrieve_block(iter->get_coords(), block);
             if (!found) {
-                missing_blocks.push_back(block);
+                missing_blocks.push_back(std::move(*iter));
             }
         }
 
         // call non-blocking prefetcher (might no-op)
-        curr_fetcher->prefetch_blocks(missing_blocks, zoom);
+        block_fetcher->prefetch(missing_blocks, zoom);
+        if (!missing_blocks.empty()) {
+            report->prefetch = true;
+        }
     }
 
 
     auto final_time = std::chrono::high_resolution_clock::now(); 
     //std::cout << "tile time: " << std::chrono::duration_cast<std::chrono::milliseconds>(final_time-initial_time).count() << " milliseconds" << std::endl;
+    report->prefetch_ms += elapsed_ms(end_compute_intersection_time, final_time);
 }
 
+void ImageService::_synthesize_blocks(vector<Block>& blocks,
+        int zoom, shared_ptr<BlockFetch> curr_fetcher, unsigned int levels)
+{
+    if (blocks.empty()) {
+        return;
+    }
+    int childzoom = zoom - 1;
 
+    // find the finer blocks that cover each requested block
+    unordered_map<BlockCoords, Block> children;
+    vector<Block> missing_children;
+    vector<double> nostep;
+    std::tuple<size_t, size_t, size_t> blocksize = curr_fetcher->get_blocksize();
+    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+        vector<int> childoffset(3);
+        childoffset[0] = 2*iter->get_coords().x;
+        childoffset[1] = 2*iter->get_coords().y;
+        childoffset[2] = 2*iter->get_coords().z;
+        vector<unsigned int> childdims;
+        childdims.push_back(2*get<0>(blocksize));
+        childdims.push_back(2*get<1>(blocksize));
+        childdims.push_back(2*get<2>(blocksize));
+        vector<Block> childblocks = curr_fetcher->intersecting_blocks(
+                childdims, childoffset, nostep, nostep, nostep, childzoom);
+
+        for (auto citer = childblocks.begin(); citer != childblocks.end(); ++citer) {
+            const BlockCoords& coords = citer->get_coords();
+            if (children.find(coords) != children.end()) {
+                continue;
+            }
+
+            Block block = citer->clone();
+            if (!cache->retrieve_block(coords, block)) {
+                missing_children.push_back(block.clone());
+            }
+            children[coords] = std::move(block);
+        }
+    }
 
+    // fetch or build missing finer blocks and cache them
+    if (!missing_children.empty()) {
+        if (!curr_fetcher->has_zoom(childzoom) && (levels > 1)) {
+            _synthesize_blocks(missing_children, childzoom, curr_fetcher, levels-1);
+        } else {
+            curr_fetcher->fetch_blocks(missing_children, childzoom);
+        }
+
+        for (auto iter = missing_children.begin(); iter != missing_children.end(); ++iter) {
+            cache->set_block(*iter);
+            children[iter->get_coords()] = std::move(*iter);
+        }
+    }
+
+    // downsample into the requested blocks
+    boost::thread_group threads; // destructor auto deletes threads
+    int num_threads = num_worker_threads();
+
+    for (int i = 0; i < num_threads; ++i) {
+        boost::thread* t = new boost::thread(downsample_blocks, &blocks, &children, i, num_threads, zoom,
+                uncompressed_cache, curr_fetcher.get(), buffer_pool.get());
+        threads.add_thread(t);
+    }
+    threads.join_all();
+}
 
 ostream& operator<<(ostream& os, LowtisErr& err)
 {